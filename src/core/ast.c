@@ -2,11 +2,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "intern.h"
+#include "operators.h"
 
 // Forward declarations
 typedef struct ASTNode ASTNode;
 typedef struct Expression Expression;
 typedef struct Statement Statement;
+typedef struct AstArena AstArena;
+typedef struct NodeIndex NodeIndex;
+typedef struct AstConsTable AstConsTable;
 
 // Enums for node types
 typedef enum {
@@ -61,7 +73,7 @@ typedef enum {
 } LiteralType;
 
 typedef union {
-    char* string_value;
+    const char* string_value;   // interned; owned by the intern table
     double number_value;
     bool boolean_value;
 } LiteralValue;
@@ -71,45 +83,54 @@ typedef struct {
     void** items;
     size_t count;
     size_t capacity;
+    AstArena* arena;        // owner of items when arena-allocated, NULL for heap
 } Array;
 
+// Node flags
+#define AST_FLAG_ARENA 0x1  // allocated from an AstArena; never freed on its own
+#define AST_FLAG_CONSED 0x2 // in a hash-consing table; may have several parents
+
 // Base AST Node structure
 struct ASTNode {
     NodeType type;
     int line;
     int column;
+    unsigned int flags;
     struct ASTNode* parent;
 };
 
 // Expression structures
+// Names are interned: equal names share one atom and one string
 typedef struct {
     ASTNode base;
-    char* name;
+    const char* name;
+    Atom atom;
 } Identifier;
 
 typedef struct {
     ASTNode base;
     LiteralType literal_type;
     LiteralValue value;
+    Atom atom;              // string literals only, ATOM_NONE otherwise
     char* raw;
 } Literal;
 
 typedef struct {
     ASTNode base;
-    char* operator;
+    OperatorKind operator;
     Expression* left;
     Expression* right;
 } BinaryExpression;
 
 typedef struct {
     ASTNode base;
-    char* operator;
+    OperatorKind operator;
     Expression* argument;
 } UnaryExpression;
 
 typedef struct {
     ASTNode base;
-    char* operator;
+    OperatorKind operator;
     Expression* left;
     Expression* right;
 } AssignmentExpression;
@@ -258,6 +279,8 @@ typedef struct {
     ASTNode base;
     Array body; // Array of Statement*
     SourceType source_type;
+    AstArena* arena;        // arena owning the tree, NULL for heap nodes
+    NodeIndex* index;       // per-type node lists; NULL until program_build_index()
 } Program;
 
 // Union-like structures using void pointers and type checking
@@ -271,368 +294,1552 @@ struct Statement {
     // Actual type determined by base.type
 };
 
+// Arena allocation
+// Nodes, strings and child arrays of one tree can be bump-allocated from
+// an arena and released together with ast_arena_destroy(). Arena memory
+// is never freed piecemeal.
+typedef struct AstArenaChunk {
+    struct AstArenaChunk* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} AstArenaChunk;
+
+struct AstArena {
+    AstArenaChunk* chunks;  // newest first; allocation happens in the head
+    size_t chunk_count;
+    size_t bytes_used;
+    AstConsTable* cons;     // shared expression nodes; NULL unless hash-consing
+};
+
+// Allocation state to roll back to
+typedef struct {
+    AstArenaChunk* chunk;
+    size_t used;
+    size_t chunk_count;
+    size_t bytes_used;
+} AstArenaMark;
+
+#define AST_ARENA_CHUNK_SIZE (64 * 1024)
+#define AST_ARENA_ALIGN 8
+
+AstArena* ast_arena_create(void) {
+    AstArena* arena = malloc(sizeof(AstArena));
+    if (!arena) return NULL;
+    arena->chunks = NULL;
+    arena->chunk_count = 0;
+    arena->bytes_used = 0;
+    arena->cons = NULL;
+    return arena;
+}
+
+void* ast_arena_alloc(AstArena* arena, size_t size) {
+    size = (size + AST_ARENA_ALIGN - 1) & ~(size_t)(AST_ARENA_ALIGN - 1);
+    
+    AstArenaChunk* chunk = arena->chunks;
+    if (!chunk || chunk->capacity - chunk->used < size) {
+        size_t capacity = size > AST_ARENA_CHUNK_SIZE ? size : AST_ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(AstArenaChunk) + capacity);
+        if (!chunk) return NULL;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        // An oversized chunk goes behind the head so the head keeps its space
+        if (arena->chunks && size > AST_ARENA_CHUNK_SIZE) {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+        }
+        arena->chunk_count++;
+    }
+    
+    void* memory = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->bytes_used += size;
+    return memory;
+}
+
+AstArenaMark ast_arena_mark(const AstArena* arena) {
+    AstArenaMark mark = { NULL, 0, 0, 0 };
+    if (arena) {
+        mark.chunk = arena->chunks;
+        mark.used = arena->chunks ? arena->chunks->used : 0;
+        mark.chunk_count = arena->chunk_count;
+        mark.bytes_used = arena->bytes_used;
+    }
+    return mark;
+}
+
+// Give back everything allocated since mark. Only possible while those
+// allocations all sit in the chunk that was the head at the mark; otherwise
+// the memory stays allocated until the arena is destroyed.
+void ast_arena_release(AstArena* arena, AstArenaMark mark) {
+    if (!arena || !mark.chunk || arena->chunks != mark.chunk || arena->chunk_count != mark.chunk_count) return;
+    mark.chunk->used = mark.used;
+    arena->bytes_used = mark.bytes_used;
+}
+
+char* ast_arena_strdup(AstArena* arena, const char* str) {
+    size_t length = strlen(str);
+    char* copy = ast_arena_alloc(arena, length + 1);
+    if (copy) memcpy(copy, str, length + 1);
+    return copy;
+}
+
+static void free_cons_table(AstConsTable* table);
+
+void ast_arena_destroy(AstArena* arena) {
+    if (!arena) return;
+    
+    free_cons_table(arena->cons);
+    AstArenaChunk* chunk = arena->chunks;
+    while (chunk) {
+        AstArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
 // Dynamic array functions
 Array* array_create(size_t initial_capacity) {
     Array* arr = malloc(sizeof(Array));
     arr->items = malloc(sizeof(void*) * initial_capacity);
     arr->count = 0;
     arr->capacity = initial_capacity;
+    arr->arena = NULL;
+    return arr;
+}
+
+// Array whose header and items live in an arena; NULL arena means heap
+Array* array_create_in(AstArena* arena, size_t initial_capacity) {
+    if (!arena) return array_create(initial_capacity);
+    
+    Array* arr = ast_arena_alloc(arena, sizeof(Array));
+    arr->items = ast_arena_alloc(arena, sizeof(void*) * initial_capacity);
+    arr->count = 0;
+    arr->capacity = initial_capacity;
+    arr->arena = arena;
     return arr;
 }
 
 void array_push(Array* arr, void* item) {
     if (arr->count >= arr->capacity) {
-        arr->capacity *= 2;
-        arr->items = realloc(arr->items, sizeof(void*) * arr->capacity);
+        size_t capacity = arr->capacity ? arr->capacity * 2 : 4;
+        if (arr->arena) {
+            // Arena items cannot be reallocated; the old block is abandoned
+            void** items = ast_arena_alloc(arr->arena, sizeof(void*) * capacity);
+            if (arr->count > 0) memcpy(items, arr->items, sizeof(void*) * arr->count);
+            arr->items = items;
+        } else {
+            arr->items = realloc(arr->items, sizeof(void*) * capacity);
+        }
+        arr->capacity = capacity;
     }
     arr->items[arr->count++] = item;
 }
 
 void array_free(Array* arr) {
+    if (arr->arena) return;
     free(arr->items);
     free(arr);
 }
 
-// AST Builder functions
-Identifier* create_identifier(const char* name, int line, int column) {
-    Identifier* node = malloc(sizeof(Identifier));
-    node->base.type = NODE_IDENTIFIER;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
-    node->name = strdup(name);
+// Free the items of an array embedded in a node
+static void array_release(Array* arr) {
+    if (!arr->arena) free(arr->items);
+}
+
+// Builders take ownership of the Array they are given. Arena nodes get
+// their items copied into the arena at their final size.
+static void array_adopt(AstArena* arena, Array* dst, Array* src) {
+    if (!src) {
+        dst->items = NULL;
+        dst->count = 0;
+        dst->capacity = 0;
+        dst->arena = arena;
+        return;
+    }
+    
+    *dst = *src;
+    if (arena && !src->arena) {
+        dst->items = NULL;
+        if (src->count > 0) {
+            dst->items = ast_arena_alloc(arena, sizeof(void*) * src->count);
+            memcpy(dst->items, src->items, sizeof(void*) * src->count);
+        }
+        dst->capacity = src->count;
+        dst->arena = arena;
+        free(src->items);
+    }
+    if (!src->arena) free(src);
+}
+
+static char* ast_strdup(AstArena* arena, const char* str) {
+    if (!str) return NULL;
+    return arena ? ast_arena_strdup(arena, str) : strdup(str);
+}
+
+// Allocate a node and fill in its base; NULL arena means heap
+static void* ast_alloc_node(AstArena* arena, size_t size, NodeType type, int line, int column) {
+    ASTNode* node = arena ? ast_arena_alloc(arena, size) : malloc(size);
+    node->type = type;
+    node->line = line;
+    node->column = column;
+    node->flags = arena ? AST_FLAG_ARENA : 0;
+    node->parent = NULL;
     return node;
 }
 
-Literal* create_literal_string(const char* value, const char* raw, int line, int column) {
-    Literal* node = malloc(sizeof(Literal));
-    node->base.type = NODE_LITERAL;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+// Return the shared node equal to node when the arena is hash-consing,
+// releasing node's memory back to mark; otherwise node itself
+static void* ast_cons(AstArena* arena, void* node, AstArenaMark mark);
+
+// AST Builder functions
+// Every builder takes the arena to allocate from first; pass NULL to
+// allocate the node on the heap and release it with free_ast_node().
+// Expression builders return shared nodes when the arena is hash-consing.
+Identifier* create_identifier_atom(AstArena* arena, Atom atom, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    Identifier* node = ast_alloc_node(arena, sizeof(Identifier), NODE_IDENTIFIER, line, column);
+    node->name = atom_string(atom);
+    node->atom = atom;
+    return ast_cons(arena, node, mark);
+}
+
+Identifier* create_identifier(AstArena* arena, const char* name, int line, int column) {
+    return create_identifier_atom(arena, intern_string(name), line, column);
+}
+
+// Interned names compare by atom
+bool identifier_equals(const Identifier* a, const Identifier* b) {
+    return a->atom == b->atom;
+}
+
+Literal* create_literal_string(AstArena* arena, const char* value, const char* raw, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    Literal* node = ast_alloc_node(arena, sizeof(Literal), NODE_LITERAL, line, column);
     node->literal_type = LITERAL_STRING;
-    node->value.string_value = strdup(value);
-    node->raw = raw ? strdup(raw) : NULL;
-    return node;
+    node->atom = intern_string(value);
+    node->value.string_value = atom_string(node->atom);
+    node->raw = ast_strdup(arena, raw);
+    return ast_cons(arena, node, mark);
 }
 
-Literal* create_literal_number(double value, const char* raw, int line, int column) {
-    Literal* node = malloc(sizeof(Literal));
-    node->base.type = NODE_LITERAL;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+Literal* create_literal_number(AstArena* arena, double value, const char* raw, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    Literal* node = ast_alloc_node(arena, sizeof(Literal), NODE_LITERAL, line, column);
     node->literal_type = LITERAL_NUMBER;
+    node->atom = ATOM_NONE;
     node->value.number_value = value;
-    node->raw = raw ? strdup(raw) : NULL;
-    return node;
+    node->raw = ast_strdup(arena, raw);
+    return ast_cons(arena, node, mark);
 }
 
-Literal* create_literal_boolean(bool value, const char* raw, int line, int column) {
-    Literal* node = malloc(sizeof(Literal));
-    node->base.type = NODE_LITERAL;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+Literal* create_literal_boolean(AstArena* arena, bool value, const char* raw, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    Literal* node = ast_alloc_node(arena, sizeof(Literal), NODE_LITERAL, line, column);
     node->literal_type = LITERAL_BOOLEAN;
+    node->atom = ATOM_NONE;
     node->value.boolean_value = value;
-    node->raw = raw ? strdup(raw) : NULL;
-    return node;
+    node->raw = ast_strdup(arena, raw);
+    return ast_cons(arena, node, mark);
 }
 
-Literal* create_literal_null(const char* raw, int line, int column) {
-    Literal* node = malloc(sizeof(Literal));
-    node->base.type = NODE_LITERAL;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+Literal* create_literal_null(AstArena* arena, const char* raw, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    Literal* node = ast_alloc_node(arena, sizeof(Literal), NODE_LITERAL, line, column);
     node->literal_type = LITERAL_NULL;
-    node->raw = raw ? strdup(raw) : NULL;
-    return node;
+    node->atom = ATOM_NONE;
+    node->raw = ast_strdup(arena, raw);
+    return ast_cons(arena, node, mark);
 }
 
-BinaryExpression* create_binary_expression(const char* operator, Expression* left, 
+BinaryExpression* create_binary_expression(AstArena* arena, OperatorKind operator, Expression* left, 
                                          Expression* right, int line, int column) {
-    BinaryExpression* node = malloc(sizeof(BinaryExpression));
-    node->base.type = NODE_BINARY_EXPRESSION;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
-    node->operator = strdup(operator);
+    AstArenaMark mark = ast_arena_mark(arena);
+    BinaryExpression* node = ast_alloc_node(arena, sizeof(BinaryExpression), NODE_BINARY_EXPRESSION,
+                                            line, column);
+    node->operator = operator;
     node->left = left;
     node->right = right;
-    return node;
+    return ast_cons(arena, node, mark);
 }
 
-UnaryExpression* create_unary_expression(const char* operator, Expression* argument,
+UnaryExpression* create_unary_expression(AstArena* arena, OperatorKind operator, Expression* argument,
                                        int line, int column) {
-    UnaryExpression* node = malloc(sizeof(UnaryExpression));
-    node->base.type = NODE_UNARY_EXPRESSION;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
-    node->operator = strdup(operator);
+    AstArenaMark mark = ast_arena_mark(arena);
+    UnaryExpression* node = ast_alloc_node(arena, sizeof(UnaryExpression), NODE_UNARY_EXPRESSION,
+                                           line, column);
+    node->operator = operator;
     node->argument = argument;
-    return node;
+    return ast_cons(arena, node, mark);
+}
+
+AssignmentExpression* create_assignment_expression(AstArena* arena, OperatorKind operator, Expression* left,
+                                                 Expression* right, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    AssignmentExpression* node = ast_alloc_node(arena, sizeof(AssignmentExpression),
+                                                NODE_ASSIGNMENT_EXPRESSION, line, column);
+    node->operator = operator;
+    node->left = left;
+    node->right = right;
+    return ast_cons(arena, node, mark);
 }
 
-CallExpression* create_call_expression(Expression* callee, Array* arguments,
+CallExpression* create_call_expression(AstArena* arena, Expression* callee, Array* arguments,
                                      int line, int column) {
-    CallExpression* node = malloc(sizeof(CallExpression));
-    node->base.type = NODE_CALL_EXPRESSION;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+    AstArenaMark mark = ast_arena_mark(arena);
+    CallExpression* node = ast_alloc_node(arena, sizeof(CallExpression), NODE_CALL_EXPRESSION, line, column);
     node->callee = callee;
-    node->arguments = *arguments;
+    array_adopt(arena, &node->arguments, arguments);
+    return ast_cons(arena, node, mark);
+}
+
+MemberExpression* create_member_expression(AstArena* arena, Expression* object, Expression* property,
+                                         bool computed, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    MemberExpression* node = ast_alloc_node(arena, sizeof(MemberExpression), NODE_MEMBER_EXPRESSION,
+                                            line, column);
+    node->object = object;
+    node->property = property;
+    node->computed = computed;
+    return ast_cons(arena, node, mark);
+}
+
+ArrayExpression* create_array_expression(AstArena* arena, Array* elements, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    ArrayExpression* node = ast_alloc_node(arena, sizeof(ArrayExpression), NODE_ARRAY_EXPRESSION,
+                                           line, column);
+    array_adopt(arena, &node->elements, elements);
+    return ast_cons(arena, node, mark);
+}
+
+Property* create_property(AstArena* arena, Expression* key, Expression* value, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    Property* node = ast_alloc_node(arena, sizeof(Property), NODE_PROPERTY, line, column);
+    node->key = key;
+    node->value = value;
+    return ast_cons(arena, node, mark);
+}
+
+ObjectExpression* create_object_expression(AstArena* arena, Array* properties, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    ObjectExpression* node = ast_alloc_node(arena, sizeof(ObjectExpression), NODE_OBJECT_EXPRESSION,
+                                            line, column);
+    array_adopt(arena, &node->properties, properties);
+    return ast_cons(arena, node, mark);
+}
+
+ConditionalExpression* create_conditional_expression(AstArena* arena, Expression* test, Expression* consequent,
+                                                   Expression* alternate, int line, int column) {
+    AstArenaMark mark = ast_arena_mark(arena);
+    ConditionalExpression* node = ast_alloc_node(arena, sizeof(ConditionalExpression),
+                                                 NODE_CONDITIONAL_EXPRESSION, line, column);
+    node->test = test;
+    node->consequent = consequent;
+    node->alternate = alternate;
+    return ast_cons(arena, node, mark);
+}
+
+ExpressionStatement* create_expression_statement(AstArena* arena, Expression* expression,
+                                               int line, int column) {
+    ExpressionStatement* node = ast_alloc_node(arena, sizeof(ExpressionStatement),
+                                               NODE_EXPRESSION_STATEMENT, line, column);
+    node->expression = expression;
     return node;
 }
 
-VariableDeclarator* create_variable_declarator(Identifier* id, Expression* init,
+VariableDeclarator* create_variable_declarator(AstArena* arena, Identifier* id, Expression* init,
                                              int line, int column) {
-    VariableDeclarator* node = malloc(sizeof(VariableDeclarator));
-    node->base.type = NODE_VARIABLE_DECLARATOR;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+    VariableDeclarator* node = ast_alloc_node(arena, sizeof(VariableDeclarator), NODE_VARIABLE_DECLARATOR,
+                                              line, column);
     node->id = id;
     node->init = init;
     return node;
 }
 
-VariableDeclaration* create_variable_declaration(Array* declarations, VariableKind kind,
+VariableDeclaration* create_variable_declaration(AstArena* arena, Array* declarations, VariableKind kind,
                                                int line, int column) {
-    VariableDeclaration* node = malloc(sizeof(VariableDeclaration));
-    node->base.type = NODE_VARIABLE_DECLARATION;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
-    node->declarations = *declarations;
+    VariableDeclaration* node = ast_alloc_node(arena, sizeof(VariableDeclaration),
+                                               NODE_VARIABLE_DECLARATION, line, column);
+    array_adopt(arena, &node->declarations, declarations);
     node->kind = kind;
     return node;
 }
 
-Parameter* create_parameter(Identifier* name, const char* param_type, 
+Parameter* create_parameter(AstArena* arena, Identifier* name, const char* param_type, 
                           Expression* default_value, int line, int column) {
-    Parameter* node = malloc(sizeof(Parameter));
-    node->base.type = NODE_PARAMETER;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+    Parameter* node = ast_alloc_node(arena, sizeof(Parameter), NODE_PARAMETER, line, column);
     node->name = name;
-    node->param_type = param_type ? strdup(param_type) : NULL;
+    node->param_type = ast_strdup(arena, param_type);
     node->default_value = default_value;
     return node;
 }
 
-BlockStatement* create_block_statement(Array* body, int line, int column) {
-    BlockStatement* node = malloc(sizeof(BlockStatement));
-    node->base.type = NODE_BLOCK_STATEMENT;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
-    node->body = *body;
+BlockStatement* create_block_statement(AstArena* arena, Array* body, int line, int column) {
+    BlockStatement* node = ast_alloc_node(arena, sizeof(BlockStatement), NODE_BLOCK_STATEMENT, line, column);
+    array_adopt(arena, &node->body, body);
     return node;
 }
 
-FunctionDeclaration* create_function_declaration(Identifier* id, Array* params,
+FunctionDeclaration* create_function_declaration(AstArena* arena, Identifier* id, Array* params,
                                                BlockStatement* body, const char* return_type,
                                                int line, int column) {
-    FunctionDeclaration* node = malloc(sizeof(FunctionDeclaration));
-    node->base.type = NODE_FUNCTION_DECLARATION;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+    FunctionDeclaration* node = ast_alloc_node(arena, sizeof(FunctionDeclaration),
+                                               NODE_FUNCTION_DECLARATION, line, column);
     node->id = id;
-    node->params = *params;
+    array_adopt(arena, &node->params, params);
     node->body = body;
-    node->return_type = return_type ? strdup(return_type) : NULL;
+    node->return_type = ast_strdup(arena, return_type);
     return node;
 }
 
-ReturnStatement* create_return_statement(Expression* argument, int line, int column) {
-    ReturnStatement* node = malloc(sizeof(ReturnStatement));
-    node->base.type = NODE_RETURN_STATEMENT;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
+ReturnStatement* create_return_statement(AstArena* arena, Expression* argument, int line, int column) {
+    ReturnStatement* node = ast_alloc_node(arena, sizeof(ReturnStatement), NODE_RETURN_STATEMENT,
+                                           line, column);
     node->argument = argument;
     return node;
 }
 
-Program* create_program(Array* body, SourceType source_type, int line, int column) {
-    Program* node = malloc(sizeof(Program));
-    node->base.type = NODE_PROGRAM;
-    node->base.line = line;
-    node->base.column = column;
-    node->base.parent = NULL;
-    node->body = *body;
-    node->source_type = source_type;
+IfStatement* create_if_statement(AstArena* arena, Expression* test, Statement* consequent,
+                               Statement* alternate, int line, int column) {
+    IfStatement* node = ast_alloc_node(arena, sizeof(IfStatement), NODE_IF_STATEMENT, line, column);
+    node->test = test;
+    node->consequent = consequent;
+    node->alternate = alternate;
     return node;
 }
 
-// Visitor function type
-typedef void (*VisitorFunc)(ASTNode* node, ASTNode* parent, void* data);
+WhileStatement* create_while_statement(AstArena* arena, Expression* test, Statement* body,
+                                     int line, int column) {
+    WhileStatement* node = ast_alloc_node(arena, sizeof(WhileStatement), NODE_WHILE_STATEMENT, line, column);
+    node->test = test;
+    node->body = body;
+    return node;
+}
 
-// AST traversal function
-void traverse_ast(ASTNode* node, VisitorFunc enter, VisitorFunc exit, void* data) {
-    traverse_ast_with_parent(node, NULL, enter, exit, data);
+ForStatement* create_for_statement(AstArena* arena, ASTNode* init, Expression* test, Expression* update,
+                                 Statement* body, int line, int column) {
+    ForStatement* node = ast_alloc_node(arena, sizeof(ForStatement), NODE_FOR_STATEMENT, line, column);
+    node->init = init;
+    node->test = test;
+    node->update = update;
+    node->body = body;
+    return node;
 }
 
-void traverse_ast_with_parent(ASTNode* node, ASTNode* parent, 
-                             VisitorFunc enter, VisitorFunc exit, void* data) {
-    if (!node) return;
-    
-    if (enter) {
-        enter(node, parent, data);
+BreakStatement* create_break_statement(AstArena* arena, Identifier* label, int line, int column) {
+    BreakStatement* node = ast_alloc_node(arena, sizeof(BreakStatement), NODE_BREAK_STATEMENT, line, column);
+    node->label = label;
+    return node;
+}
+
+ContinueStatement* create_continue_statement(AstArena* arena, Identifier* label, int line, int column) {
+    ContinueStatement* node = ast_alloc_node(arena, sizeof(ContinueStatement), NODE_CONTINUE_STATEMENT,
+                                             line, column);
+    node->label = label;
+    return node;
+}
+
+ThrowStatement* create_throw_statement(AstArena* arena, Expression* argument, int line, int column) {
+    ThrowStatement* node = ast_alloc_node(arena, sizeof(ThrowStatement), NODE_THROW_STATEMENT, line, column);
+    node->argument = argument;
+    return node;
+}
+
+CatchClause* create_catch_clause(AstArena* arena, Identifier* param, BlockStatement* body,
+                               int line, int column) {
+    CatchClause* node = ast_alloc_node(arena, sizeof(CatchClause), NODE_CATCH_CLAUSE, line, column);
+    node->param = param;
+    node->body = body;
+    return node;
+}
+
+TryStatement* create_try_statement(AstArena* arena, BlockStatement* block, CatchClause* handler,
+                                 BlockStatement* finalizer, int line, int column) {
+    TryStatement* node = ast_alloc_node(arena, sizeof(TryStatement), NODE_TRY_STATEMENT, line, column);
+    node->block = block;
+    node->handler = handler;
+    node->finalizer = finalizer;
+    return node;
+}
+
+SwitchCase* create_switch_case(AstArena* arena, Expression* test, Array* consequent, int line, int column) {
+    SwitchCase* node = ast_alloc_node(arena, sizeof(SwitchCase), NODE_SWITCH_CASE, line, column);
+    node->test = test;
+    array_adopt(arena, &node->consequent, consequent);
+    return node;
+}
+
+SwitchStatement* create_switch_statement(AstArena* arena, Expression* discriminant, Array* cases,
+                                       int line, int column) {
+    SwitchStatement* node = ast_alloc_node(arena, sizeof(SwitchStatement), NODE_SWITCH_STATEMENT,
+                                           line, column);
+    node->discriminant = discriminant;
+    array_adopt(arena, &node->cases, cases);
+    return node;
+}
+
+// The program takes ownership of the arena its nodes were built in, so
+// free_ast_node() on the program releases the whole tree at once
+Program* create_program(AstArena* arena, Array* body, SourceType source_type, int line, int column) {
+    Program* node = ast_alloc_node(arena, sizeof(Program), NODE_PROGRAM, line, column);
+    array_adopt(arena, &node->body, body);
+    node->source_type = source_type;
+    node->arena = arena;
+    node->index = NULL;
+    return node;
+}
+
+// Child access
+// Children of every node type in source order. Optional children that are
+// absent are reported as NULL, so the count depends only on the node type
+// and the length of its lists.
+size_t ast_child_count(const ASTNode* node) {
+    switch (node->type) {
+        case NODE_BINARY_EXPRESSION:
+        case NODE_ASSIGNMENT_EXPRESSION:
+        case NODE_MEMBER_EXPRESSION:
+        case NODE_PROPERTY:
+        case NODE_VARIABLE_DECLARATOR:
+        case NODE_PARAMETER:
+        case NODE_WHILE_STATEMENT:
+        case NODE_CATCH_CLAUSE:
+            return 2;
+        case NODE_UNARY_EXPRESSION:
+        case NODE_EXPRESSION_STATEMENT:
+        case NODE_RETURN_STATEMENT:
+        case NODE_BREAK_STATEMENT:
+        case NODE_CONTINUE_STATEMENT:
+        case NODE_THROW_STATEMENT:
+            return 1;
+        case NODE_CONDITIONAL_EXPRESSION:
+        case NODE_IF_STATEMENT:
+        case NODE_TRY_STATEMENT:
+            return 3;
+        case NODE_FOR_STATEMENT:
+            return 4;
+        case NODE_CALL_EXPRESSION:
+            return 1 + ((const CallExpression*)node)->arguments.count;
+        case NODE_ARRAY_EXPRESSION:
+            return ((const ArrayExpression*)node)->elements.count;
+        case NODE_OBJECT_EXPRESSION:
+            return ((const ObjectExpression*)node)->properties.count;
+        case NODE_VARIABLE_DECLARATION:
+            return ((const VariableDeclaration*)node)->declarations.count;
+        case NODE_FUNCTION_DECLARATION:
+            return 2 + ((const FunctionDeclaration*)node)->params.count;
+        case NODE_BLOCK_STATEMENT:
+            return ((const BlockStatement*)node)->body.count;
+        case NODE_SWITCH_STATEMENT:
+            return 1 + ((const SwitchStatement*)node)->cases.count;
+        case NODE_SWITCH_CASE:
+            return 1 + ((const SwitchCase*)node)->consequent.count;
+        case NODE_PROGRAM:
+            return ((const Program*)node)->body.count;
+        case NODE_IDENTIFIER:
+        case NODE_LITERAL:
+            return 0;
     }
-    
-    // Visit children based on node type
+    return 0;
+}
+
+ASTNode* ast_child(const ASTNode* node, size_t index) {
+    switch (node->type) {
+        case NODE_BINARY_EXPRESSION: {
+            const BinaryExpression* bin = (const BinaryExpression*)node;
+            return (ASTNode*)(index == 0 ? bin->left : bin->right);
+        }
+        case NODE_ASSIGNMENT_EXPRESSION: {
+            const AssignmentExpression* assign = (const AssignmentExpression*)node;
+            return (ASTNode*)(index == 0 ? assign->left : assign->right);
+        }
+        case NODE_UNARY_EXPRESSION:
+            return (ASTNode*)((const UnaryExpression*)node)->argument;
+        case NODE_CALL_EXPRESSION: {
+            const CallExpression* call = (const CallExpression*)node;
+            return index == 0 ? (ASTNode*)call->callee : call->arguments.items[index - 1];
+        }
+        case NODE_MEMBER_EXPRESSION: {
+            const MemberExpression* member = (const MemberExpression*)node;
+            return (ASTNode*)(index == 0 ? member->object : member->property);
+        }
+        case NODE_ARRAY_EXPRESSION:
+            return ((const ArrayExpression*)node)->elements.items[index];
+        case NODE_OBJECT_EXPRESSION:
+            return ((const ObjectExpression*)node)->properties.items[index];
+        case NODE_PROPERTY: {
+            const Property* prop = (const Property*)node;
+            return (ASTNode*)(index == 0 ? prop->key : prop->value);
+        }
+        case NODE_CONDITIONAL_EXPRESSION: {
+            const ConditionalExpression* cond = (const ConditionalExpression*)node;
+            return (ASTNode*)(index == 0 ? cond->test : index == 1 ? cond->consequent : cond->alternate);
+        }
+        case NODE_EXPRESSION_STATEMENT:
+            return (ASTNode*)((const ExpressionStatement*)node)->expression;
+        case NODE_VARIABLE_DECLARATION:
+            return ((const VariableDeclaration*)node)->declarations.items[index];
+        case NODE_VARIABLE_DECLARATOR: {
+            const VariableDeclarator* var_declarator = (const VariableDeclarator*)node;
+            return index == 0 ? (ASTNode*)var_declarator->id : (ASTNode*)var_declarator->init;
+        }
+        case NODE_FUNCTION_DECLARATION: {
+            const FunctionDeclaration* func = (const FunctionDeclaration*)node;
+            if (index == 0) return (ASTNode*)func->id;
+            if (index <= func->params.count) return func->params.items[index - 1];
+            return (ASTNode*)func->body;
+        }
+        case NODE_PARAMETER: {
+            const Parameter* param = (const Parameter*)node;
+            return index == 0 ? (ASTNode*)param->name : (ASTNode*)param->default_value;
+        }
+        case NODE_BLOCK_STATEMENT:
+            return ((const BlockStatement*)node)->body.items[index];
+        case NODE_RETURN_STATEMENT:
+            return (ASTNode*)((const ReturnStatement*)node)->argument;
+        case NODE_IF_STATEMENT: {
+            const IfStatement* if_stmt = (const IfStatement*)node;
+            return index == 0 ? (ASTNode*)if_stmt->test :
+                   index == 1 ? (ASTNode*)if_stmt->consequent : (ASTNode*)if_stmt->alternate;
+        }
+        case NODE_WHILE_STATEMENT: {
+            const WhileStatement* while_stmt = (const WhileStatement*)node;
+            return index == 0 ? (ASTNode*)while_stmt->test : (ASTNode*)while_stmt->body;
+        }
+        case NODE_FOR_STATEMENT: {
+            const ForStatement* for_stmt = (const ForStatement*)node;
+            return index == 0 ? for_stmt->init :
+                   index == 1 ? (ASTNode*)for_stmt->test :
+                   index == 2 ? (ASTNode*)for_stmt->update : (ASTNode*)for_stmt->body;
+        }
+        case NODE_BREAK_STATEMENT:
+            return (ASTNode*)((const BreakStatement*)node)->label;
+        case NODE_CONTINUE_STATEMENT:
+            return (ASTNode*)((const ContinueStatement*)node)->label;
+        case NODE_THROW_STATEMENT:
+            return (ASTNode*)((const ThrowStatement*)node)->argument;
+        case NODE_TRY_STATEMENT: {
+            const TryStatement* try_stmt = (const TryStatement*)node;
+            return index == 0 ? (ASTNode*)try_stmt->block :
+                   index == 1 ? (ASTNode*)try_stmt->handler : (ASTNode*)try_stmt->finalizer;
+        }
+        case NODE_CATCH_CLAUSE: {
+            const CatchClause* catch_clause = (const CatchClause*)node;
+            return index == 0 ? (ASTNode*)catch_clause->param : (ASTNode*)catch_clause->body;
+        }
+        case NODE_SWITCH_STATEMENT: {
+            const SwitchStatement* switch_stmt = (const SwitchStatement*)node;
+            return index == 0 ? (ASTNode*)switch_stmt->discriminant : switch_stmt->cases.items[index - 1];
+        }
+        case NODE_SWITCH_CASE: {
+            const SwitchCase* switch_case = (const SwitchCase*)node;
+            return index == 0 ? (ASTNode*)switch_case->test : switch_case->consequent.items[index - 1];
+        }
+        case NODE_PROGRAM:
+            return ((const Program*)node)->body.items[index];
+        case NODE_IDENTIFIER:
+        case NODE_LITERAL:
+            return NULL;
+    }
+    return NULL;
+}
+
+// Store child as the node's index-th child, in ast_child() order
+void ast_set_child(ASTNode* node, size_t index, ASTNode* child) {
     switch (node->type) {
         case NODE_BINARY_EXPRESSION: {
             BinaryExpression* bin = (BinaryExpression*)node;
-            traverse_ast_with_parent((ASTNode*)bin->left, node, enter, exit, data);
-            traverse_ast_with_parent((ASTNode*)bin->right, node, enter, exit, data);
+            if (index == 0) bin->left = (Expression*)child;
+            else bin->right = (Expression*)child;
             break;
         }
-        case NODE_UNARY_EXPRESSION: {
-            UnaryExpression* unary = (UnaryExpression*)node;
-            traverse_ast_with_parent((ASTNode*)unary->argument, node, enter, exit, data);
+        case NODE_ASSIGNMENT_EXPRESSION: {
+            AssignmentExpression* assign = (AssignmentExpression*)node;
+            if (index == 0) assign->left = (Expression*)child;
+            else assign->right = (Expression*)child;
             break;
         }
+        case NODE_UNARY_EXPRESSION:
+            ((UnaryExpression*)node)->argument = (Expression*)child;
+            break;
         case NODE_CALL_EXPRESSION: {
             CallExpression* call = (CallExpression*)node;
-            traverse_ast_with_parent((ASTNode*)call->callee, node, enter, exit, data);
-            for (size_t i = 0; i < call->arguments.count; i++) {
-                traverse_ast_with_parent((ASTNode*)call->arguments.items[i], node, enter, exit, data);
-            }
+            if (index == 0) call->callee = (Expression*)child;
+            else call->arguments.items[index - 1] = child;
             break;
         }
-        case NODE_VARIABLE_DECLARATION: {
-            VariableDeclaration* var_decl = (VariableDeclaration*)node;
-            for (size_t i = 0; i < var_decl->declarations.count; i++) {
-                traverse_ast_with_parent((ASTNode*)var_decl->declarations.items[i], node, enter, exit, data);
-            }
+        case NODE_MEMBER_EXPRESSION: {
+            MemberExpression* member = (MemberExpression*)node;
+            if (index == 0) member->object = (Expression*)child;
+            else member->property = (Expression*)child;
+            break;
+        }
+        case NODE_ARRAY_EXPRESSION:
+            ((ArrayExpression*)node)->elements.items[index] = child;
+            break;
+        case NODE_OBJECT_EXPRESSION:
+            ((ObjectExpression*)node)->properties.items[index] = child;
+            break;
+        case NODE_PROPERTY: {
+            Property* prop = (Property*)node;
+            if (index == 0) prop->key = (Expression*)child;
+            else prop->value = (Expression*)child;
+            break;
+        }
+        case NODE_CONDITIONAL_EXPRESSION: {
+            ConditionalExpression* cond = (ConditionalExpression*)node;
+            if (index == 0) cond->test = (Expression*)child;
+            else if (index == 1) cond->consequent = (Expression*)child;
+            else cond->alternate = (Expression*)child;
             break;
         }
+        case NODE_EXPRESSION_STATEMENT:
+            ((ExpressionStatement*)node)->expression = (Expression*)child;
+            break;
+        case NODE_VARIABLE_DECLARATION:
+            ((VariableDeclaration*)node)->declarations.items[index] = child;
+            break;
         case NODE_VARIABLE_DECLARATOR: {
             VariableDeclarator* var_declarator = (VariableDeclarator*)node;
-            traverse_ast_with_parent((ASTNode*)var_declarator->id, node, enter, exit, data);
-            if (var_declarator->init) {
-                traverse_ast_with_parent((ASTNode*)var_declarator->init, node, enter, exit, data);
-            }
+            if (index == 0) var_declarator->id = (Identifier*)child;
+            else var_declarator->init = (Expression*)child;
             break;
         }
         case NODE_FUNCTION_DECLARATION: {
             FunctionDeclaration* func = (FunctionDeclaration*)node;
-            traverse_ast_with_parent((ASTNode*)func->id, node, enter, exit, data);
-            for (size_t i = 0; i < func->params.count; i++) {
-                traverse_ast_with_parent((ASTNode*)func->params.items[i], node, enter, exit, data);
-            }
-            traverse_ast_with_parent((ASTNode*)func->body, node, enter, exit, data);
+            if (index == 0) func->id = (Identifier*)child;
+            else if (index <= func->params.count) func->params.items[index - 1] = child;
+            else func->body = (BlockStatement*)child;
             break;
         }
         case NODE_PARAMETER: {
             Parameter* param = (Parameter*)node;
-            traverse_ast_with_parent((ASTNode*)param->name, node, enter, exit, data);
-            if (param->default_value) {
-                traverse_ast_with_parent((ASTNode*)param->default_value, node, enter, exit, data);
-            }
+            if (index == 0) param->name = (Identifier*)child;
+            else param->default_value = (Expression*)child;
             break;
         }
-        case NODE_BLOCK_STATEMENT: {
-            BlockStatement* block = (BlockStatement*)node;
-            for (size_t i = 0; i < block->body.count; i++) {
-                traverse_ast_with_parent((ASTNode*)block->body.items[i], node, enter, exit, data);
-            }
-            break;
-        }
-        case NODE_RETURN_STATEMENT: {
-            ReturnStatement* ret = (ReturnStatement*)node;
-            if (ret->argument) {
-                traverse_ast_with_parent((ASTNode*)ret->argument, node, enter, exit, data);
-            }
+        case NODE_BLOCK_STATEMENT:
+            ((BlockStatement*)node)->body.items[index] = child;
             break;
-        }
-        case NODE_PROGRAM: {
-            Program* program = (Program*)node;
-            for (size_t i = 0; i < program->body.count; i++) {
-                traverse_ast_with_parent((ASTNode*)program->body.items[i], node, enter, exit, data);
-            }
+        case NODE_RETURN_STATEMENT:
+            ((ReturnStatement*)node)->argument = (Expression*)child;
             break;
-        }
         case NODE_IF_STATEMENT: {
             IfStatement* if_stmt = (IfStatement*)node;
-            traverse_ast_with_parent((ASTNode*)if_stmt->test, node, enter, exit, data);
-            traverse_ast_with_parent((ASTNode*)if_stmt->consequent, node, enter, exit, data);
-            if (if_stmt->alternate) {
-                traverse_ast_with_parent((ASTNode*)if_stmt->alternate, node, enter, exit, data);
-            }
+            if (index == 0) if_stmt->test = (Expression*)child;
+            else if (index == 1) if_stmt->consequent = (Statement*)child;
+            else if_stmt->alternate = (Statement*)child;
             break;
         }
         case NODE_WHILE_STATEMENT: {
             WhileStatement* while_stmt = (WhileStatement*)node;
-            traverse_ast_with_parent((ASTNode*)while_stmt->test, node, enter, exit, data);
-            traverse_ast_with_parent((ASTNode*)while_stmt->body, node, enter, exit, data);
+            if (index == 0) while_stmt->test = (Expression*)child;
+            else while_stmt->body = (Statement*)child;
             break;
         }
-        case NODE_ARRAY_EXPRESSION: {
-            ArrayExpression* arr = (ArrayExpression*)node;
-            for (size_t i = 0; i < arr->elements.count; i++) {
-                traverse_ast_with_parent((ASTNode*)arr->elements.items[i], node, enter, exit, data);
-            }
+        case NODE_FOR_STATEMENT: {
+            ForStatement* for_stmt = (ForStatement*)node;
+            if (index == 0) for_stmt->init = child;
+            else if (index == 1) for_stmt->test = (Expression*)child;
+            else if (index == 2) for_stmt->update = (Expression*)child;
+            else for_stmt->body = (Statement*)child;
             break;
         }
-        case NODE_OBJECT_EXPRESSION: {
-            ObjectExpression* obj = (ObjectExpression*)node;
-            for (size_t i = 0; i < obj->properties.count; i++) {
-                traverse_ast_with_parent((ASTNode*)obj->properties.items[i], node, enter, exit, data);
-            }
+        case NODE_BREAK_STATEMENT:
+            ((BreakStatement*)node)->label = (Identifier*)child;
+            break;
+        case NODE_CONTINUE_STATEMENT:
+            ((ContinueStatement*)node)->label = (Identifier*)child;
+            break;
+        case NODE_THROW_STATEMENT:
+            ((ThrowStatement*)node)->argument = (Expression*)child;
+            break;
+        case NODE_TRY_STATEMENT: {
+            TryStatement* try_stmt = (TryStatement*)node;
+            if (index == 0) try_stmt->block = (BlockStatement*)child;
+            else if (index == 1) try_stmt->handler = (CatchClause*)child;
+            else try_stmt->finalizer = (BlockStatement*)child;
             break;
         }
-        case NODE_PROPERTY: {
-            Property* prop = (Property*)node;
-            traverse_ast_with_parent((ASTNode*)prop->key, node, enter, exit, data);
-            traverse_ast_with_parent((ASTNode*)prop->value, node, enter, exit, data);
+        case NODE_CATCH_CLAUSE: {
+            CatchClause* catch_clause = (CatchClause*)node;
+            if (index == 0) catch_clause->param = (Identifier*)child;
+            else catch_clause->body = (BlockStatement*)child;
             break;
         }
-        // Add other cases as needed
-        default:
+        case NODE_SWITCH_STATEMENT: {
+            SwitchStatement* switch_stmt = (SwitchStatement*)node;
+            if (index == 0) switch_stmt->discriminant = (Expression*)child;
+            else switch_stmt->cases.items[index - 1] = child;
+            break;
+        }
+        case NODE_SWITCH_CASE: {
+            SwitchCase* switch_case = (SwitchCase*)node;
+            if (index == 0) switch_case->test = (Expression*)child;
+            else switch_case->consequent.items[index - 1] = child;
+            break;
+        }
+        case NODE_PROGRAM:
+            ((Program*)node)->body.items[index] = child;
+            break;
+        case NODE_IDENTIFIER:
+        case NODE_LITERAL:
             break;
     }
+}
+
+// Visitor function type
+typedef void (*VisitorFunc)(ASTNode* node, ASTNode* parent, void* data);
+
+// Walk control returned by visitors
+typedef enum {
+    VISIT_CONTINUE,         // descend into the node's children
+    VISIT_SKIP_CHILDREN,    // leave the children out; exit is still called
+    VISIT_STOP              // end the walk; no further callbacks
+} VisitResult;
+
+typedef VisitResult (*AstVisitor)(ASTNode* node, ASTNode* parent, void* data);
+
+typedef struct {
+    ASTNode* node;
+    ASTNode* parent;
+    size_t next;            // next child to visit
+    size_t count;           // 0 when the children are skipped
+} WalkFrame;
+
+#define WALK_INLINE_DEPTH 64
+
+// Depth-first walk calling enter before a node's children and exit after
+// them. The stack is explicit, so nesting depth is limited only by memory.
+// Returns false if a visitor stopped the walk (or memory ran out).
+static bool walk_ast_with_parent(ASTNode* root, ASTNode* root_parent,
+                                 AstVisitor enter, AstVisitor exit, void* data) {
+    if (!root) return true;
+    
+    VisitResult result = enter ? enter(root, root_parent, data) : VISIT_CONTINUE;
+    if (result == VISIT_STOP) return false;
+    
+    WalkFrame inline_stack[WALK_INLINE_DEPTH];
+    WalkFrame* stack = inline_stack;
+    size_t capacity = WALK_INLINE_DEPTH;
+    size_t depth = 0;
+    bool completed = true;
     
-    if (exit) {
-        exit(node, parent, data);
+    stack[depth++] = (WalkFrame){ root, root_parent, 0,
+                                  result == VISIT_SKIP_CHILDREN ? 0 : ast_child_count(root) };
+    while (depth > 0) {
+        WalkFrame* frame = &stack[depth - 1];
+        if (frame->next < frame->count) {
+            ASTNode* child = ast_child(frame->node, frame->next++);
+            if (!child) continue;
+            
+            result = enter ? enter(child, frame->node, data) : VISIT_CONTINUE;
+            if (result == VISIT_STOP) {
+                completed = false;
+                break;
+            }
+            if (depth == capacity) {
+                WalkFrame* grown = malloc(sizeof(WalkFrame) * capacity * 2);
+                if (!grown) {
+                    completed = false;
+                    break;
+                }
+                memcpy(grown, stack, sizeof(WalkFrame) * depth);
+                if (stack != inline_stack) free(stack);
+                stack = grown;
+                capacity *= 2;
+                frame = &stack[depth - 1];
+            }
+            stack[depth++] = (WalkFrame){ child, frame->node, 0,
+                                          result == VISIT_SKIP_CHILDREN ? 0 : ast_child_count(child) };
+            continue;
+        }
+        
+        if (exit && exit(frame->node, frame->parent, data) == VISIT_STOP) {
+            completed = false;
+            break;
+        }
+        depth--;
     }
+    
+    if (stack != inline_stack) free(stack);
+    return completed;
 }
 
-// Utility functions for finding nodes
+bool walk_ast(ASTNode* root, AstVisitor enter, AstVisitor exit, void* data) {
+    return walk_ast_with_parent(root, NULL, enter, exit, data);
+}
+
+// Adapters running plain VisitorFuncs on the walker
 typedef struct {
-    NodeType target_type;
-    Array* results;
-} FindNodesData;
+    VisitorFunc enter;
+    VisitorFunc exit;
+    void* data;
+} TraverseAdapter;
 
-void find_nodes_visitor(ASTNode* node, ASTNode* parent, void* data) {
-    FindNodesData* find_data = (FindNodesData*)data;
-    if (node->type == find_data->target_type) {
-        array_push(find_data->results, node);
-    }
+static VisitResult traverse_enter(ASTNode* node, ASTNode* parent, void* data) {
+    TraverseAdapter* adapter = data;
+    adapter->enter(node, parent, adapter->data);
+    return VISIT_CONTINUE;
 }
 
-Array* find_nodes_by_type(ASTNode* root, NodeType type) {
-    Array* results = array_create(10);
-    FindNodesData data = { type, results };
-    traverse_ast(root, find_nodes_visitor, NULL, &data);
-    return results;
+static VisitResult traverse_exit(ASTNode* node, ASTNode* parent, void* data) {
+    TraverseAdapter* adapter = data;
+    adapter->exit(node, parent, adapter->data);
+    return VISIT_CONTINUE;
 }
 
-// Pretty print function
-const char* node_type_to_string(NodeType type) {
-    switch (type) {
-        case NODE_PROGRAM: return "Program";
-        case NODE_IDENTIFIER: return "Identifier";
-        case NODE_LITERAL: return "Literal";
-        case NODE_BINARY_EXPRESSION: return "BinaryExpression";
+// AST traversal function
+void traverse_ast_with_parent(ASTNode* node, ASTNode* parent, 
+                             VisitorFunc enter, VisitorFunc exit, void* data) {
+    TraverseAdapter adapter = { enter, exit, data };
+    walk_ast_with_parent(node, parent, enter ? traverse_enter : NULL,
+                         exit ? traverse_exit : NULL, &adapter);
+}
+
+void traverse_ast(ASTNode* node, VisitorFunc enter, VisitorFunc exit, void* data) {
+    traverse_ast_with_parent(node, NULL, enter, exit, data);
+}
+
+// Which node types can appear below which. Built from the shape of the
+// node structs (an expression never holds a statement, a declarator only
+// holds its name and initializer, ...) and closed transitively, so a
+// search can skip subtrees that cannot hold what it is looking for.
+#define NODE_TYPE_COUNT (NODE_SWITCH_CASE + 1)
+#define NODE_BIT(type) (1u << (type))
+
+#define EXPRESSION_TYPES (NODE_BIT(NODE_IDENTIFIER) | NODE_BIT(NODE_LITERAL) | \
+                          NODE_BIT(NODE_BINARY_EXPRESSION) | NODE_BIT(NODE_UNARY_EXPRESSION) | \
+                          NODE_BIT(NODE_ASSIGNMENT_EXPRESSION) | NODE_BIT(NODE_CALL_EXPRESSION) | \
+                          NODE_BIT(NODE_MEMBER_EXPRESSION) | NODE_BIT(NODE_ARRAY_EXPRESSION) | \
+                          NODE_BIT(NODE_OBJECT_EXPRESSION) | NODE_BIT(NODE_CONDITIONAL_EXPRESSION))
+#define STATEMENT_TYPES (NODE_BIT(NODE_EXPRESSION_STATEMENT) | NODE_BIT(NODE_VARIABLE_DECLARATION) | \
+                         NODE_BIT(NODE_FUNCTION_DECLARATION) | NODE_BIT(NODE_BLOCK_STATEMENT) | \
+                         NODE_BIT(NODE_RETURN_STATEMENT) | NODE_BIT(NODE_IF_STATEMENT) | \
+                         NODE_BIT(NODE_WHILE_STATEMENT) | NODE_BIT(NODE_FOR_STATEMENT) | \
+                         NODE_BIT(NODE_BREAK_STATEMENT) | NODE_BIT(NODE_CONTINUE_STATEMENT) | \
+                         NODE_BIT(NODE_THROW_STATEMENT) | NODE_BIT(NODE_TRY_STATEMENT) | \
+                         NODE_BIT(NODE_SWITCH_STATEMENT))
+
+static const uint32_t node_child_types[NODE_TYPE_COUNT] = {
+    [NODE_PROGRAM] = STATEMENT_TYPES,
+    [NODE_IDENTIFIER] = 0,
+    [NODE_LITERAL] = 0,
+    [NODE_BINARY_EXPRESSION] = EXPRESSION_TYPES,
+    [NODE_UNARY_EXPRESSION] = EXPRESSION_TYPES,
+    [NODE_ASSIGNMENT_EXPRESSION] = EXPRESSION_TYPES,
+    [NODE_CALL_EXPRESSION] = EXPRESSION_TYPES,
+    [NODE_MEMBER_EXPRESSION] = EXPRESSION_TYPES,
+    [NODE_ARRAY_EXPRESSION] = EXPRESSION_TYPES,
+    [NODE_OBJECT_EXPRESSION] = NODE_BIT(NODE_PROPERTY),
+    [NODE_PROPERTY] = EXPRESSION_TYPES,
+    [NODE_CONDITIONAL_EXPRESSION] = EXPRESSION_TYPES,
+    [NODE_EXPRESSION_STATEMENT] = EXPRESSION_TYPES,
+    [NODE_VARIABLE_DECLARATION] = NODE_BIT(NODE_VARIABLE_DECLARATOR),
+    [NODE_VARIABLE_DECLARATOR] = EXPRESSION_TYPES,
+    [NODE_FUNCTION_DECLARATION] = NODE_BIT(NODE_IDENTIFIER) | NODE_BIT(NODE_PARAMETER) |
+                                  NODE_BIT(NODE_BLOCK_STATEMENT),
+    [NODE_PARAMETER] = EXPRESSION_TYPES,
+    [NODE_BLOCK_STATEMENT] = STATEMENT_TYPES,
+    [NODE_RETURN_STATEMENT] = EXPRESSION_TYPES,
+    [NODE_IF_STATEMENT] = EXPRESSION_TYPES | STATEMENT_TYPES,
+    [NODE_WHILE_STATEMENT] = EXPRESSION_TYPES | STATEMENT_TYPES,
+    [NODE_FOR_STATEMENT] = EXPRESSION_TYPES | STATEMENT_TYPES,
+    [NODE_BREAK_STATEMENT] = NODE_BIT(NODE_IDENTIFIER),
+    [NODE_CONTINUE_STATEMENT] = NODE_BIT(NODE_IDENTIFIER),
+    [NODE_THROW_STATEMENT] = EXPRESSION_TYPES,
+    [NODE_TRY_STATEMENT] = NODE_BIT(NODE_BLOCK_STATEMENT) | NODE_BIT(NODE_CATCH_CLAUSE),
+    [NODE_CATCH_CLAUSE] = NODE_BIT(NODE_IDENTIFIER) | NODE_BIT(NODE_BLOCK_STATEMENT),
+    [NODE_SWITCH_STATEMENT] = EXPRESSION_TYPES | NODE_BIT(NODE_SWITCH_CASE),
+    [NODE_SWITCH_CASE] = EXPRESSION_TYPES | STATEMENT_TYPES
+};
+
+// Bit t of node_descendant_types[p] is set if a p node can have a t node
+// anywhere below it
+static uint32_t node_descendant_types[NODE_TYPE_COUNT];
+static bool node_descendant_types_ready = false;
+
+static void build_node_descendant_types(void) {
+    for (int type = 0; type < NODE_TYPE_COUNT; type++) {
+        node_descendant_types[type] = node_child_types[type];
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int type = 0; type < NODE_TYPE_COUNT; type++) {
+            uint32_t reach = node_descendant_types[type];
+            for (int child = 0; child < NODE_TYPE_COUNT; child++) {
+                if (reach & NODE_BIT(child)) reach |= node_descendant_types[child];
+            }
+            if (reach != node_descendant_types[type]) {
+                node_descendant_types[type] = reach;
+                changed = true;
+            }
+        }
+    }
+    node_descendant_types_ready = true;
+}
+
+// Whether a subtree rooted at a node of type parent can contain target nodes
+bool node_can_contain(NodeType parent, NodeType target) {
+    if (!node_descendant_types_ready) build_node_descendant_types();
+    return (node_descendant_types[parent] & NODE_BIT(target)) != 0;
+}
+
+// Same, for any of the types in a NODE_BIT() mask
+static bool node_can_contain_any(NodeType parent, uint32_t target_mask) {
+    if (!node_descendant_types_ready) build_node_descendant_types();
+    return (node_descendant_types[parent] & target_mask) != 0;
+}
+
+// Node index
+// Every node of a program grouped by type, each group in depth-first
+// order, built in one walk and cached on the Program. The index is a
+// snapshot: call program_invalidate_index() after editing the tree.
+struct NodeIndex {
+    ASTNode** nodes;
+    size_t starts[NODE_TYPE_COUNT + 1]; // type t is nodes[starts[t], starts[t + 1])
+};
+
+typedef struct {
+    ASTNode** nodes;
+    size_t count;
+    size_t capacity;
+    size_t type_counts[NODE_TYPE_COUNT];
+    bool failed;
+} IndexBuild;
+
+static VisitResult index_visitor(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    IndexBuild* build = data;
+    if (build->count == build->capacity) {
+        size_t capacity = build->capacity ? build->capacity * 2 : 256;
+        ASTNode** nodes = realloc(build->nodes, sizeof(ASTNode*) * capacity);
+        if (!nodes) {
+            build->failed = true;
+            return VISIT_STOP;
+        }
+        build->nodes = nodes;
+        build->capacity = capacity;
+    }
+    build->nodes[build->count++] = node;
+    build->type_counts[node->type]++;
+    return VISIT_CONTINUE;
+}
+
+bool program_build_index(Program* program) {
+    if (program->index) return true;
+    
+    IndexBuild build;
+    memset(&build, 0, sizeof(build));
+    walk_ast((ASTNode*)program, index_visitor, NULL, &build);
+    
+    NodeIndex* index = build.failed ? NULL : malloc(sizeof(NodeIndex));
+    ASTNode** nodes = index ? malloc(sizeof(ASTNode*) * (build.count ? build.count : 1)) : NULL;
+    if (!nodes) {
+        free(index);
+        free(build.nodes);
+        return false;
+    }
+    
+    // Stable counting sort by type keeps each group in walk order
+    index->starts[0] = 0;
+    for (int type = 0; type < NODE_TYPE_COUNT; type++) {
+        index->starts[type + 1] = index->starts[type] + build.type_counts[type];
+    }
+    size_t cursor[NODE_TYPE_COUNT];
+    memcpy(cursor, index->starts, sizeof(cursor));
+    for (size_t i = 0; i < build.count; i++) {
+        nodes[cursor[build.nodes[i]->type]++] = build.nodes[i];
+    }
+    index->nodes = nodes;
+    free(build.nodes);
+    
+    program->index = index;
+    return true;
+}
+
+void program_invalidate_index(Program* program) {
+    if (!program->index) return;
+    free(program->index->nodes);
+    free(program->index);
+    program->index = NULL;
+}
+
+// Nodes of one type, from the program's index (built on first use). The
+// list belongs to the index; it is valid until the index is invalidated.
+ASTNode** program_nodes_of_type(Program* program, NodeType type, size_t* count) {
+    *count = 0;
+    if (!program_build_index(program)) return NULL;
+    NodeIndex* index = program->index;
+    *count = index->starts[type + 1] - index->starts[type];
+    return index->nodes + index->starts[type];
+}
+
+static Array* array_from_items(void** items, size_t count) {
+    Array* results = array_create(count);
+    if (count > 0) memcpy(results->items, items, sizeof(void*) * count);
+    results->count = count;
+    return results;
+}
+
+static Array* index_results(const NodeIndex* index, NodeType type) {
+    return array_from_items((void**)index->nodes + index->starts[type],
+                            index->starts[type + 1] - index->starts[type]);
+}
+
+// Utility functions for finding nodes
+typedef struct {
+    NodeType target_type;
+    Array* results;
+} FindNodesData;
+
+static VisitResult find_nodes_visitor(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    FindNodesData* find_data = (FindNodesData*)data;
+    if (node->type == find_data->target_type) {
+        array_push(find_data->results, node);
+    }
+    // Nothing below this node can match
+    if (!node_can_contain(node->type, find_data->target_type)) return VISIT_SKIP_CHILDREN;
+    return VISIT_CONTINUE;
+}
+
+// Served from the index when root is an indexed Program
+Array* find_nodes_by_type(ASTNode* root, NodeType type) {
+    if (root && root->type == NODE_PROGRAM && ((Program*)root)->index) {
+        return index_results(((Program*)root)->index, type);
+    }
+    
+    Array* results = array_create(10);
+    FindNodesData data = { type, results };
+    walk_ast(root, find_nodes_visitor, NULL, &data);
+    return results;
+}
+
+typedef struct {
+    NodeType target_type;
+    ASTNode* found;
+} FindFirstData;
+
+static VisitResult find_first_visitor(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    FindFirstData* find_data = (FindFirstData*)data;
+    if (node->type == find_data->target_type) {
+        find_data->found = node;
+        return VISIT_STOP;
+    }
+    if (!node_can_contain(node->type, find_data->target_type)) return VISIT_SKIP_CHILDREN;
+    return VISIT_CONTINUE;
+}
+
+// First node of a type in depth-first order, NULL if there is none
+ASTNode* find_first_node_by_type(ASTNode* root, NodeType type) {
+    FindFirstData data = { type, NULL };
+    walk_ast(root, find_first_visitor, NULL, &data);
+    return data.found;
+}
+
+typedef struct {
+    uint32_t target_mask;
+    Array** results_by_type; // indexed by NodeType, NULL for types not asked for
+} FindManyData;
+
+static VisitResult find_many_visitor(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    FindManyData* find_data = data;
+    if (find_data->target_mask & NODE_BIT(node->type)) {
+        array_push(find_data->results_by_type[node->type], node);
+    }
+    if (!node_can_contain_any(node->type, find_data->target_mask)) return VISIT_SKIP_CHILDREN;
+    return VISIT_CONTINUE;
+}
+
+// Nodes of several types at once: results[i] receives the nodes of
+// types[i], in depth-first order, from a single walk (or from the index
+// when root is an indexed Program). The caller frees each results[i].
+void find_nodes_by_types(ASTNode* root, const NodeType* types, size_t type_count, Array** results) {
+    if (root && root->type == NODE_PROGRAM && ((Program*)root)->index) {
+        for (size_t i = 0; i < type_count; i++) {
+            results[i] = index_results(((Program*)root)->index, types[i]);
+        }
+        return;
+    }
+    
+    Array* by_type[NODE_TYPE_COUNT] = { NULL };
+    FindManyData data = { 0, by_type };
+    for (size_t i = 0; i < type_count; i++) {
+        if (!by_type[types[i]]) by_type[types[i]] = array_create(10);
+        data.target_mask |= NODE_BIT(types[i]);
+    }
+    walk_ast(root, find_many_visitor, NULL, &data);
+    
+    for (size_t i = 0; i < type_count; i++) {
+        if (by_type[types[i]]) {
+            results[i] = by_type[types[i]];
+            by_type[types[i]] = NULL;
+            continue;
+        }
+        // A type asked for twice gets its own copy
+        for (size_t j = 0; j < i; j++) {
+            if (types[j] == types[i]) {
+                results[i] = array_from_items(results[j]->items, results[j]->count);
+                break;
+            }
+        }
+    }
+}
+
+// Structural hashing
+// Two subtrees are structurally equal when they have the same shape, node
+// types and node values (names, literal values and raw text, operators,
+// declaration kinds and type annotations); positions are ignored. Hashes
+// agree for equal subtrees and are only meaningful within one process,
+// since they cover atoms.
+static uint64_t hash_combine(uint64_t hash, uint64_t value) {
+    value *= 0x9e3779b97f4a7c15ull;
+    value ^= value >> 32;
+    hash ^= value;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+static uint64_t hash_text(uint64_t hash, const char* text) {
+    if (!text) return hash_combine(hash, 0);
+    uint64_t value = 14695981039346656037ull;
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        value ^= *p;
+        value *= 1099511628211ull;
+    }
+    return hash_combine(hash, value | 1);
+}
+
+static bool text_equal(const char* a, const char* b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+#define AST_HASH_NULL 0x6e756c6cull    // stands in for an absent child
+
+// Hash of a node's type, values and child count, but not its children
+static uint64_t node_value_hash(const ASTNode* node) {
+    uint64_t hash = hash_combine((uint64_t)node->type, ast_child_count(node));
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            return hash_combine(hash, ((const Identifier*)node)->atom);
+        case NODE_LITERAL: {
+            const Literal* lit = (const Literal*)node;
+            hash = hash_combine(hash, lit->literal_type);
+            if (lit->literal_type == LITERAL_STRING) {
+                hash = hash_combine(hash, lit->atom);
+            } else if (lit->literal_type == LITERAL_NUMBER) {
+                uint64_t bits;
+                memcpy(&bits, &lit->value.number_value, sizeof(bits));
+                hash = hash_combine(hash, bits);
+            } else if (lit->literal_type == LITERAL_BOOLEAN) {
+                hash = hash_combine(hash, lit->value.boolean_value);
+            }
+            return hash_text(hash, lit->raw);
+        }
+        case NODE_BINARY_EXPRESSION:
+            return hash_combine(hash, ((const BinaryExpression*)node)->operator);
+        case NODE_UNARY_EXPRESSION:
+            return hash_combine(hash, ((const UnaryExpression*)node)->operator);
+        case NODE_ASSIGNMENT_EXPRESSION:
+            return hash_combine(hash, ((const AssignmentExpression*)node)->operator);
+        case NODE_MEMBER_EXPRESSION:
+            return hash_combine(hash, ((const MemberExpression*)node)->computed);
+        case NODE_VARIABLE_DECLARATION:
+            return hash_combine(hash, ((const VariableDeclaration*)node)->kind);
+        case NODE_PARAMETER:
+            return hash_text(hash, ((const Parameter*)node)->param_type);
+        case NODE_FUNCTION_DECLARATION:
+            return hash_text(hash, ((const FunctionDeclaration*)node)->return_type);
+        case NODE_PROGRAM:
+            return hash_combine(hash, ((const Program*)node)->source_type);
+        default:
+            return hash;
+    }
+}
+
+// Whether two nodes agree in everything node_value_hash() covers.
+// Numbers compare by bit pattern, so 0 and -0 differ and NaN equals itself.
+static bool node_values_equal(const ASTNode* a, const ASTNode* b) {
+    if (a->type != b->type || ast_child_count(a) != ast_child_count(b)) return false;
+    
+    switch (a->type) {
+        case NODE_IDENTIFIER:
+            return ((const Identifier*)a)->atom == ((const Identifier*)b)->atom;
+        case NODE_LITERAL: {
+            const Literal* x = (const Literal*)a;
+            const Literal* y = (const Literal*)b;
+            if (x->literal_type != y->literal_type || !text_equal(x->raw, y->raw)) return false;
+            switch (x->literal_type) {
+                case LITERAL_STRING:
+                    return x->atom == y->atom;
+                case LITERAL_NUMBER:
+                    return memcmp(&x->value.number_value, &y->value.number_value, sizeof(double)) == 0;
+                case LITERAL_BOOLEAN:
+                    return x->value.boolean_value == y->value.boolean_value;
+                case LITERAL_NULL:
+                    return true;
+            }
+            return false;
+        }
+        case NODE_BINARY_EXPRESSION:
+            return ((const BinaryExpression*)a)->operator == ((const BinaryExpression*)b)->operator;
+        case NODE_UNARY_EXPRESSION:
+            return ((const UnaryExpression*)a)->operator == ((const UnaryExpression*)b)->operator;
+        case NODE_ASSIGNMENT_EXPRESSION:
+            return ((const AssignmentExpression*)a)->operator == ((const AssignmentExpression*)b)->operator;
+        case NODE_MEMBER_EXPRESSION:
+            return ((const MemberExpression*)a)->computed == ((const MemberExpression*)b)->computed;
+        case NODE_VARIABLE_DECLARATION:
+            return ((const VariableDeclaration*)a)->kind == ((const VariableDeclaration*)b)->kind;
+        case NODE_PARAMETER:
+            return text_equal(((const Parameter*)a)->param_type, ((const Parameter*)b)->param_type);
+        case NODE_FUNCTION_DECLARATION:
+            return text_equal(((const FunctionDeclaration*)a)->return_type,
+                              ((const FunctionDeclaration*)b)->return_type);
+        case NODE_PROGRAM:
+            return ((const Program*)a)->source_type == ((const Program*)b)->source_type;
+        default:
+            return true;
+    }
+}
+
+typedef struct {
+    uint64_t* hashes;       // hashes of finished subtrees whose parent is still open
+    size_t count;
+    size_t capacity;
+    bool failed;
+} HashData;
+
+static VisitResult hash_exit(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    HashData* hash_data = data;
+    
+    // The finished children are the last entries on the stack, in order
+    size_t count = ast_child_count(node);
+    size_t present = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ast_child(node, i)) present++;
+    }
+    size_t next = hash_data->count - present;
+    uint64_t hash = node_value_hash(node);
+    for (size_t i = 0; i < count; i++) {
+        hash = hash_combine(hash, ast_child(node, i) ? hash_data->hashes[next++] : AST_HASH_NULL);
+    }
+    hash_data->count -= present;
+    
+    if (hash_data->count == hash_data->capacity) {
+        size_t capacity = hash_data->capacity ? hash_data->capacity * 2 : 64;
+        uint64_t* grown = realloc(hash_data->hashes, sizeof(uint64_t) * capacity);
+        if (!grown) {
+            hash_data->failed = true;
+            return VISIT_STOP;
+        }
+        hash_data->hashes = grown;
+        hash_data->capacity = capacity;
+    }
+    hash_data->hashes[hash_data->count++] = hash;
+    return VISIT_CONTINUE;
+}
+
+// Structural hash of a subtree. Iterative, so depth is not limited by the
+// C stack. Returns 0 if memory ran out.
+uint64_t ast_hash(const ASTNode* node) {
+    if (!node) return AST_HASH_NULL;
+    
+    HashData data = { NULL, 0, 0, false };
+    walk_ast((ASTNode*)node, NULL, hash_exit, &data);
+    uint64_t hash = data.failed ? 0 : data.hashes[0];
+    free(data.hashes);
+    return hash;
+}
+
+typedef struct {
+    const ASTNode* a;
+    const ASTNode* b;
+} EqualPair;
+
+// Structural equality of two subtrees, ignoring positions. Shared
+// subtrees compare equal without being visited.
+bool ast_equal(const ASTNode* a, const ASTNode* b) {
+    EqualPair inline_stack[WALK_INLINE_DEPTH];
+    EqualPair* stack = inline_stack;
+    size_t capacity = WALK_INLINE_DEPTH;
+    size_t depth = 0;
+    bool equal = true;
+    
+    stack[depth++] = (EqualPair){ a, b };
+    while (depth > 0 && equal) {
+        EqualPair pair = stack[--depth];
+        if (pair.a == pair.b) continue;
+        if (!pair.a || !pair.b || !node_values_equal(pair.a, pair.b)) {
+            equal = false;
+            break;
+        }
+        
+        size_t count = ast_child_count(pair.a);
+        if (depth + count > capacity) {
+            while (depth + count > capacity) capacity *= 2;
+            EqualPair* grown = malloc(sizeof(EqualPair) * capacity);
+            if (!grown) {
+                equal = false;
+                break;
+            }
+            memcpy(grown, stack, sizeof(EqualPair) * depth);
+            if (stack != inline_stack) free(stack);
+            stack = grown;
+        }
+        for (size_t i = count; i-- > 0;) {
+            stack[depth++] = (EqualPair){ ast_child(pair.a, i), ast_child(pair.b, i) };
+        }
+    }
+    
+    if (stack != inline_stack) free(stack);
+    return equal;
+}
+
+// Hash-consing
+// An arena can be switched into a mode where the expression builders
+// return an existing node instead of a new one when an equal expression
+// was already built in it. Children built this way are already shared, so
+// a lookup only compares node values and child pointers, not whole
+// subtrees. A shared node keeps the position of its first occurrence and
+// may have any number of parents, so trees built this way are DAGs and
+// must not be edited in place. Heap builders never share.
+typedef struct {
+    uint64_t hash;
+    ASTNode* node;          // NULL for an empty slot
+} ConsEntry;
+
+struct AstConsTable {
+    ConsEntry* entries;
+    size_t mask;
+    size_t count;
+    size_t hits;            // builder calls answered with a shared node
+};
+
+// Hash of a node's values and the identities of its children
+static uint64_t cons_hash(const ASTNode* node) {
+    uint64_t hash = node_value_hash(node);
+    size_t count = ast_child_count(node);
+    for (size_t i = 0; i < count; i++) {
+        hash = hash_combine(hash, (uint64_t)(uintptr_t)ast_child(node, i));
+    }
+    return hash;
+}
+
+static bool cons_equal(const ASTNode* a, const ASTNode* b) {
+    if (!node_values_equal(a, b)) return false;
+    size_t count = ast_child_count(a);
+    for (size_t i = 0; i < count; i++) {
+        if (ast_child(a, i) != ast_child(b, i)) return false;
+    }
+    return true;
+}
+
+static bool cons_table_grow(AstConsTable* table) {
+    size_t capacity = (table->mask + 1) * 2;
+    ConsEntry* entries = calloc(capacity, sizeof(ConsEntry));
+    if (!entries) return false;
+    
+    for (size_t i = 0; i <= table->mask; i++) {
+        if (!table->entries[i].node) continue;
+        size_t slot = table->entries[i].hash & (capacity - 1);
+        while (entries[slot].node) slot = (slot + 1) & (capacity - 1);
+        entries[slot] = table->entries[i];
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->mask = capacity - 1;
+    return true;
+}
+
+// Turn on hash-consing for nodes built in arena from now on
+bool ast_arena_enable_hash_consing(AstArena* arena) {
+    if (!arena) return false;
+    if (arena->cons) return true;
+    
+    AstConsTable* table = malloc(sizeof(AstConsTable));
+    if (!table) return false;
+    table->mask = 255;
+    table->count = 0;
+    table->hits = 0;
+    table->entries = calloc(table->mask + 1, sizeof(ConsEntry));
+    if (!table->entries) {
+        free(table);
+        return false;
+    }
+    arena->cons = table;
+    return true;
+}
+
+// Builder calls that returned a shared node instead of a new one
+size_t ast_arena_shared_count(const AstArena* arena) {
+    return arena && arena->cons ? arena->cons->hits : 0;
+}
+
+static void free_cons_table(AstConsTable* table) {
+    if (!table) return;
+    
+    free(table->entries);
+    free(table);
+}
+
+static void* ast_cons(AstArena* arena, void* node, AstArenaMark mark) {
+    if (!arena || !arena->cons || !node) return node;
+    
+    AstConsTable* table = arena->cons;
+    uint64_t hash = cons_hash(node);
+    size_t slot = hash & table->mask;
+    for (; table->entries[slot].node; slot = (slot + 1) & table->mask) {
+        ConsEntry* entry = &table->entries[slot];
+        if (entry->hash == hash && cons_equal(entry->node, node)) {
+            ast_arena_release(arena, mark);
+            table->hits++;
+            return entry->node;
+        }
+    }
+    
+    // Keep the table at most half full
+    if ((table->count + 1) * 2 > table->mask + 1) {
+        if (!cons_table_grow(table)) return node;
+        slot = hash & table->mask;
+        while (table->entries[slot].node) slot = (slot + 1) & table->mask;
+    }
+    table->entries[slot] = (ConsEntry){ hash, node };
+    table->count++;
+    ((ASTNode*)node)->flags |= AST_FLAG_CONSED;
+    return node;
+}
+
+static VisitResult consed_enter(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    if (!(node->flags & AST_FLAG_CONSED)) return VISIT_CONTINUE;
+    *(bool*)data = true;
+    return VISIT_STOP;
+}
+
+// Whether a tree holds hash-consed nodes, which must not be edited in place
+static bool ast_has_consed_nodes(ASTNode* root) {
+    bool found = false;
+    walk_ast(root, consed_enter, NULL, &found);
+    return found;
+}
+
+// Pretty print function
+const char* node_type_to_string(NodeType type) {
+    switch (type) {
+        case NODE_PROGRAM: return "Program";
+        case NODE_IDENTIFIER: return "Identifier";
+        case NODE_LITERAL: return "Literal";
+        case NODE_BINARY_EXPRESSION: return "BinaryExpression";
         case NODE_UNARY_EXPRESSION: return "UnaryExpression";
         case NODE_ASSIGNMENT_EXPRESSION: return "AssignmentExpression";
         case NODE_CALL_EXPRESSION: return "CallExpression";
@@ -698,12 +1905,12 @@ void pretty_print_ast(ASTNode* node, int indent) {
         }
         case NODE_BINARY_EXPRESSION: {
             BinaryExpression* bin = (BinaryExpression*)node;
-            printf(" (%s)", bin->operator);
+            printf(" (%s)", operator_to_string(bin->operator));
             break;
         }
         case NODE_UNARY_EXPRESSION: {
             UnaryExpression* unary = (UnaryExpression*)node;
-            printf(" (%s)", unary->operator);
+            printf(" (%s)", operator_to_string(unary->operator));
             break;
         }
     }
@@ -791,20 +1998,39 @@ void pretty_print_ast(ASTNode* node, int indent) {
 }
 
 // Memory cleanup functions
+void free_ast_node(ASTNode* node);
+
+static void free_node_array(Array* arr) {
+    for (size_t i = 0; i < arr->count; i++) {
+        free_ast_node((ASTNode*)arr->items[i]);
+    }
+    array_release(arr);
+}
+
+// Free a heap-built subtree. Arena nodes are skipped; they go away with
+// their arena, which a Program releases when it is freed.
 void free_ast_node(ASTNode* node) {
     if (!node) return;
     
+    if (node->type == NODE_PROGRAM) program_invalidate_index((Program*)node);
+    if (node->type == NODE_PROGRAM && ((Program*)node)->arena) {
+        Program* program = (Program*)node;
+        AstArena* arena = program->arena;
+        if (!(node->flags & AST_FLAG_ARENA)) {
+            free_node_array(&program->body);
+            free(program);
+        }
+        ast_arena_destroy(arena);
+        return;
+    }
+    if (node->flags & AST_FLAG_ARENA) return;
+    
     switch (node->type) {
-        case NODE_IDENTIFIER: {
-            Identifier* id = (Identifier*)node;
-            free(id->name);
+        case NODE_IDENTIFIER:
+            // Name is interned
             break;
-        }
         case NODE_LITERAL: {
             Literal* lit = (Literal*)node;
-            if (lit->literal_type == LITERAL_STRING) {
-                free(lit->value.string_value);
-            }
             if (lit->raw) {
                 free(lit->raw);
             }
@@ -812,93 +2038,1578 @@ void free_ast_node(ASTNode* node) {
         }
         case NODE_BINARY_EXPRESSION: {
             BinaryExpression* bin = (BinaryExpression*)node;
-            free(bin->operator);
             free_ast_node((ASTNode*)bin->left);
             free_ast_node((ASTNode*)bin->right);
             break;
         }
         case NODE_UNARY_EXPRESSION: {
             UnaryExpression* unary = (UnaryExpression*)node;
-            free(unary->operator);
             free_ast_node((ASTNode*)unary->argument);
             break;
         }
-        case NODE_VARIABLE_DECLARATION: {
-            VariableDeclaration* var_decl = (VariableDeclaration*)node;
-            for (size_t i = 0; i < var_decl->declarations.count; i++) {
-                free_ast_node((ASTNode*)var_decl->declarations.items[i]);
-            }
-            array_free(&var_decl->declarations);
+        case NODE_ASSIGNMENT_EXPRESSION: {
+            AssignmentExpression* assign = (AssignmentExpression*)node;
+            free_ast_node((ASTNode*)assign->left);
+            free_ast_node((ASTNode*)assign->right);
+            break;
+        }
+        case NODE_CALL_EXPRESSION: {
+            CallExpression* call = (CallExpression*)node;
+            free_ast_node((ASTNode*)call->callee);
+            free_node_array(&call->arguments);
+            break;
+        }
+        case NODE_MEMBER_EXPRESSION: {
+            MemberExpression* member = (MemberExpression*)node;
+            free_ast_node((ASTNode*)member->object);
+            free_ast_node((ASTNode*)member->property);
+            break;
+        }
+        case NODE_ARRAY_EXPRESSION:
+            free_node_array(&((ArrayExpression*)node)->elements);
+            break;
+        case NODE_OBJECT_EXPRESSION:
+            free_node_array(&((ObjectExpression*)node)->properties);
+            break;
+        case NODE_PROPERTY: {
+            Property* prop = (Property*)node;
+            free_ast_node((ASTNode*)prop->key);
+            free_ast_node((ASTNode*)prop->value);
+            break;
+        }
+        case NODE_CONDITIONAL_EXPRESSION: {
+            ConditionalExpression* cond = (ConditionalExpression*)node;
+            free_ast_node((ASTNode*)cond->test);
+            free_ast_node((ASTNode*)cond->consequent);
+            free_ast_node((ASTNode*)cond->alternate);
+            break;
+        }
+        case NODE_EXPRESSION_STATEMENT:
+            free_ast_node((ASTNode*)((ExpressionStatement*)node)->expression);
+            break;
+        case NODE_VARIABLE_DECLARATION:
+            free_node_array(&((VariableDeclaration*)node)->declarations);
+            break;
+        case NODE_VARIABLE_DECLARATOR: {
+            VariableDeclarator* var_declarator = (VariableDeclarator*)node;
+            free_ast_node((ASTNode*)var_declarator->id);
+            free_ast_node((ASTNode*)var_declarator->init);
             break;
         }
         case NODE_FUNCTION_DECLARATION: {
             FunctionDeclaration* func = (FunctionDeclaration*)node;
             free_ast_node((ASTNode*)func->id);
-            for (size_t i = 0; i < func->params.count; i++) {
-                free_ast_node((ASTNode*)func->params.items[i]);
-            }
-            array_free(&func->params);
+            free_node_array(&func->params);
             free_ast_node((ASTNode*)func->body);
             if (func->return_type) {
                 free(func->return_type);
             }
             break;
         }
-        // Add cleanup for other node types
-        default:
+        case NODE_PARAMETER: {
+            Parameter* param = (Parameter*)node;
+            free_ast_node((ASTNode*)param->name);
+            free(param->param_type);
+            free_ast_node((ASTNode*)param->default_value);
             break;
-    }
-    
-    free(node);
-}
-
-// Example usage function
-void demonstrate_ast() {
-    printf("=== AST Demo ===\n\n");
-    
-    // Create identifiers
-    Identifier* x_id = create_identifier("x", 1, 1);
-    Identifier* a_id = create_identifier("a", 3, 15);
-    Identifier* b_id = create_identifier("b", 3, 25);
-    Identifier* add_id = create_identifier("add", 3, 10);
-    
-    // Create literals
-    Literal* num_42 = create_literal_number(42.0, "42", 1, 7);
-    
-    // Create variable declarator and declaration
-    VariableDeclarator* x_declarator = create_variable_declarator(x_id, (Expression*)num_42, 1, 5);
-    Array* var_declarations = array_create(1);
-    array_push(var_declarations, x_declarator);
-    VariableDeclaration* var_decl = create_variable_declaration(var_declarations, VAR_KIND_LET, 1, 1);
-    
+        }
+        case NODE_BLOCK_STATEMENT:
+            free_node_array(&((BlockStatement*)node)->body);
+            break;
+        case NODE_RETURN_STATEMENT:
+            free_ast_node((ASTNode*)((ReturnStatement*)node)->argument);
+            break;
+        case NODE_IF_STATEMENT: {
+            IfStatement* if_stmt = (IfStatement*)node;
+            free_ast_node((ASTNode*)if_stmt->test);
+            free_ast_node((ASTNode*)if_stmt->consequent);
+            free_ast_node((ASTNode*)if_stmt->alternate);
+            break;
+        }
+        case NODE_WHILE_STATEMENT: {
+            WhileStatement* while_stmt = (WhileStatement*)node;
+            free_ast_node((ASTNode*)while_stmt->test);
+            free_ast_node((ASTNode*)while_stmt->body);
+            break;
+        }
+        case NODE_FOR_STATEMENT: {
+            ForStatement* for_stmt = (ForStatement*)node;
+            free_ast_node(for_stmt->init);
+            free_ast_node((ASTNode*)for_stmt->test);
+            free_ast_node((ASTNode*)for_stmt->update);
+            free_ast_node((ASTNode*)for_stmt->body);
+            break;
+        }
+        case NODE_BREAK_STATEMENT:
+            free_ast_node((ASTNode*)((BreakStatement*)node)->label);
+            break;
+        case NODE_CONTINUE_STATEMENT:
+            free_ast_node((ASTNode*)((ContinueStatement*)node)->label);
+            break;
+        case NODE_THROW_STATEMENT:
+            free_ast_node((ASTNode*)((ThrowStatement*)node)->argument);
+            break;
+        case NODE_TRY_STATEMENT: {
+            TryStatement* try_stmt = (TryStatement*)node;
+            free_ast_node((ASTNode*)try_stmt->block);
+            free_ast_node((ASTNode*)try_stmt->handler);
+            free_ast_node((ASTNode*)try_stmt->finalizer);
+            break;
+        }
+        case NODE_CATCH_CLAUSE: {
+            CatchClause* catch_clause = (CatchClause*)node;
+            free_ast_node((ASTNode*)catch_clause->param);
+            free_ast_node((ASTNode*)catch_clause->body);
+            break;
+        }
+        case NODE_SWITCH_STATEMENT: {
+            SwitchStatement* switch_stmt = (SwitchStatement*)node;
+            free_ast_node((ASTNode*)switch_stmt->discriminant);
+            free_node_array(&switch_stmt->cases);
+            break;
+        }
+        case NODE_SWITCH_CASE: {
+            SwitchCase* switch_case = (SwitchCase*)node;
+            free_ast_node((ASTNode*)switch_case->test);
+            free_node_array(&switch_case->consequent);
+            break;
+        }
+        case NODE_PROGRAM:
+            free_node_array(&((Program*)node)->body);
+            break;
+    }
+    
+    free(node);
+}
+
+// Flat AST
+// A compact encoding of a tree: fixed-size records in one array, named by
+// 32-bit ids in preorder, so a linear scan of nodes[] visits the tree
+// depth-first and every child id is greater than its parent's. Each
+// node's children are a contiguous run of ids in the side array, in
+// ast_child() order; absent optional children are FLAT_NODE_NONE.
+// Strings are stored as atoms.
+typedef uint32_t FlatNodeId;
+
+#define FLAT_NODE_NONE UINT32_MAX
+
+typedef struct {
+    uint8_t tag;            // NodeType
+    uint8_t kind;           // OperatorKind, LiteralType, VariableKind, SourceType or computed flag
+    uint16_t reserved;
+    int32_t line;
+    int32_t column;
+    uint32_t first_child;   // index of the first child id in FlatAst.children
+    uint32_t child_count;
+    Atom text;              // raw literal text, parameter or return type
+    union {
+        Atom atom;          // identifier name or string value
+        bool boolean;
+        double number;
+    } value;
+} FlatNode;
+
+typedef struct {
+    FlatNode* nodes;
+    uint32_t count;
+    uint32_t capacity;
+    FlatNodeId* children;
+    uint32_t child_total;
+    uint32_t child_capacity;
+    FlatNodeId root;
+} FlatAst;
+
+static FlatNodeId flat_ast_child(const FlatAst* flat, FlatNodeId id, size_t index) {
+    return flat->children[flat->nodes[id].first_child + index];
+}
+
+static bool flat_ast_reserve(FlatAst* flat, uint32_t nodes, uint32_t children) {
+    if (flat->count + nodes > flat->capacity) {
+        uint32_t capacity = flat->capacity ? flat->capacity : 64;
+        while (capacity < flat->count + nodes) capacity *= 2;
+        FlatNode* grown = realloc(flat->nodes, sizeof(FlatNode) * capacity);
+        if (!grown) return false;
+        flat->nodes = grown;
+        flat->capacity = capacity;
+    }
+    if (flat->child_total + children > flat->child_capacity) {
+        uint32_t capacity = flat->child_capacity ? flat->child_capacity : 64;
+        while (capacity < flat->child_total + children) capacity *= 2;
+        FlatNodeId* grown = realloc(flat->children, sizeof(FlatNodeId) * capacity);
+        if (!grown) return false;
+        flat->children = grown;
+        flat->child_capacity = capacity;
+    }
+    return true;
+}
+
+static Atom flat_text_atom(const char* text) {
+    return text ? intern_string(text) : ATOM_NONE;
+}
+
+static void flat_encode_node(FlatNode* out, const ASTNode* node) {
+    memset(out, 0, sizeof(*out));
+    out->tag = (uint8_t)node->type;
+    out->line = node->line;
+    out->column = node->column;
+    
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            out->value.atom = ((const Identifier*)node)->atom;
+            break;
+        case NODE_LITERAL: {
+            const Literal* lit = (const Literal*)node;
+            out->kind = (uint8_t)lit->literal_type;
+            out->text = flat_text_atom(lit->raw);
+            if (lit->literal_type == LITERAL_STRING) out->value.atom = lit->atom;
+            else if (lit->literal_type == LITERAL_NUMBER) out->value.number = lit->value.number_value;
+            else if (lit->literal_type == LITERAL_BOOLEAN) out->value.boolean = lit->value.boolean_value;
+            break;
+        }
+        case NODE_BINARY_EXPRESSION:
+            out->kind = (uint8_t)((const BinaryExpression*)node)->operator;
+            break;
+        case NODE_UNARY_EXPRESSION:
+            out->kind = (uint8_t)((const UnaryExpression*)node)->operator;
+            break;
+        case NODE_ASSIGNMENT_EXPRESSION:
+            out->kind = (uint8_t)((const AssignmentExpression*)node)->operator;
+            break;
+        case NODE_MEMBER_EXPRESSION:
+            out->kind = ((const MemberExpression*)node)->computed;
+            break;
+        case NODE_VARIABLE_DECLARATION:
+            out->kind = (uint8_t)((const VariableDeclaration*)node)->kind;
+            break;
+        case NODE_PARAMETER:
+            out->text = flat_text_atom(((const Parameter*)node)->param_type);
+            break;
+        case NODE_FUNCTION_DECLARATION:
+            out->text = flat_text_atom(((const FunctionDeclaration*)node)->return_type);
+            break;
+        case NODE_PROGRAM:
+            out->kind = (uint8_t)((const Program*)node)->source_type;
+            break;
+        default:
+            break;
+    }
+}
+
+// Encode a tree. Uses an explicit stack, so depth is not limited by the
+// C stack.
+FlatAst* flat_ast_from_node(const ASTNode* root) {
+    if (!root) return NULL;
+    
+    FlatAst* flat = calloc(1, sizeof(FlatAst));
+    if (!flat) return NULL;
+    
+    typedef struct {
+        const ASTNode* node;
+        uint32_t slot;      // where the parent wants this node's id
+    } FlatWork;
+    size_t stack_capacity = 64;
+    size_t depth = 0;
+    FlatWork* stack = malloc(sizeof(FlatWork) * stack_capacity);
+    if (!stack) {
+        free(flat);
+        return NULL;
+    }
+    stack[depth++] = (FlatWork){ root, FLAT_NODE_NONE };
+    flat->root = 0;
+    
+    while (depth > 0) {
+        FlatWork work = stack[--depth];
+        uint32_t count = (uint32_t)ast_child_count(work.node);
+        if (!flat_ast_reserve(flat, 1, count)) goto fail;
+        
+        FlatNodeId id = flat->count++;
+        if (work.slot != FLAT_NODE_NONE) flat->children[work.slot] = id;
+        FlatNode* out = &flat->nodes[id];
+        flat_encode_node(out, work.node);
+        out->first_child = flat->child_total;
+        out->child_count = count;
+        flat->child_total += count;
+        
+        // Push in reverse so the first child gets the next id
+        if (depth + count > stack_capacity) {
+            while (depth + count > stack_capacity) stack_capacity *= 2;
+            FlatWork* grown = realloc(stack, sizeof(FlatWork) * stack_capacity);
+            if (!grown) goto fail;
+            stack = grown;
+        }
+        for (uint32_t i = count; i-- > 0;) {
+            const ASTNode* child = ast_child(work.node, i);
+            if (child) {
+                stack[depth++] = (FlatWork){ child, out->first_child + i };
+            } else {
+                flat->children[out->first_child + i] = FLAT_NODE_NONE;
+            }
+        }
+    }
+    free(stack);
+    
+    // Trim the growth slack; the encoding is not appended to afterwards
+    FlatNode* nodes = realloc(flat->nodes, sizeof(FlatNode) * flat->count);
+    if (nodes) {
+        flat->nodes = nodes;
+        flat->capacity = flat->count;
+    }
+    if (flat->child_total > 0) {
+        FlatNodeId* children = realloc(flat->children, sizeof(FlatNodeId) * flat->child_total);
+        if (children) {
+            flat->children = children;
+            flat->child_capacity = flat->child_total;
+        }
+    }
+    return flat;
+    
+fail:
+    free(stack);
+    free(flat->nodes);
+    free(flat->children);
+    free(flat);
+    return NULL;
+}
+
+// Collect children [first, first + count) of a flat node into a new array
+static Array* flat_child_array(const FlatAst* flat, FlatNodeId id, size_t first, size_t count,
+                               ASTNode** built, AstArena* arena) {
+    Array* arr = array_create_in(arena, count);
+    for (size_t i = 0; i < count; i++) {
+        array_push(arr, built[flat_ast_child(flat, id, first + i)]);
+    }
+    return arr;
+}
+
+static ASTNode* flat_decode_node(const FlatAst* flat, FlatNodeId id, ASTNode** built, AstArena* arena) {
+    const FlatNode* in = &flat->nodes[id];
+    const char* text = atom_string(in->text);
+    int line = in->line;
+    int column = in->column;
+    ASTNode* c[4] = { NULL, NULL, NULL, NULL };
+    for (uint32_t i = 0; i < in->child_count && i < 4; i++) {
+        FlatNodeId child = flat_ast_child(flat, id, i);
+        c[i] = child == FLAT_NODE_NONE ? NULL : built[child];
+    }
+    
+    switch ((NodeType)in->tag) {
+        case NODE_IDENTIFIER:
+            return (ASTNode*)create_identifier_atom(arena, in->value.atom, line, column);
+        case NODE_LITERAL:
+            switch ((LiteralType)in->kind) {
+                case LITERAL_STRING:
+                    return (ASTNode*)create_literal_string(arena, atom_string(in->value.atom), text, line, column);
+                case LITERAL_NUMBER:
+                    return (ASTNode*)create_literal_number(arena, in->value.number, text, line, column);
+                case LITERAL_BOOLEAN:
+                    return (ASTNode*)create_literal_boolean(arena, in->value.boolean, text, line, column);
+                case LITERAL_NULL:
+                    return (ASTNode*)create_literal_null(arena, text, line, column);
+            }
+            return NULL;
+        case NODE_BINARY_EXPRESSION:
+            return (ASTNode*)create_binary_expression(arena, (OperatorKind)in->kind, (Expression*)c[0], (Expression*)c[1],
+                                                      line, column);
+        case NODE_UNARY_EXPRESSION:
+            return (ASTNode*)create_unary_expression(arena, (OperatorKind)in->kind, (Expression*)c[0], line, column);
+        case NODE_ASSIGNMENT_EXPRESSION:
+            return (ASTNode*)create_assignment_expression(arena, (OperatorKind)in->kind, (Expression*)c[0], (Expression*)c[1],
+                                                          line, column);
+        case NODE_CALL_EXPRESSION:
+            return (ASTNode*)create_call_expression(arena, (Expression*)c[0],
+                                                    flat_child_array(flat, id, 1, in->child_count - 1, built, arena),
+                                                    line, column);
+        case NODE_MEMBER_EXPRESSION:
+            return (ASTNode*)create_member_expression(arena, (Expression*)c[0], (Expression*)c[1], in->kind,
+                                                      line, column);
+        case NODE_ARRAY_EXPRESSION:
+            return (ASTNode*)create_array_expression(arena, flat_child_array(flat, id, 0, in->child_count, built, arena),
+                                                     line, column);
+        case NODE_OBJECT_EXPRESSION:
+            return (ASTNode*)create_object_expression(arena, flat_child_array(flat, id, 0, in->child_count, built, arena),
+                                                      line, column);
+        case NODE_PROPERTY:
+            return (ASTNode*)create_property(arena, (Expression*)c[0], (Expression*)c[1], line, column);
+        case NODE_CONDITIONAL_EXPRESSION:
+            return (ASTNode*)create_conditional_expression(arena, (Expression*)c[0], (Expression*)c[1],
+                                                           (Expression*)c[2], line, column);
+        case NODE_EXPRESSION_STATEMENT:
+            return (ASTNode*)create_expression_statement(arena, (Expression*)c[0], line, column);
+        case NODE_VARIABLE_DECLARATION:
+            return (ASTNode*)create_variable_declaration(arena,
+                                                         flat_child_array(flat, id, 0, in->child_count, built, arena),
+                                                         (VariableKind)in->kind, line, column);
+        case NODE_VARIABLE_DECLARATOR:
+            return (ASTNode*)create_variable_declarator(arena, (Identifier*)c[0], (Expression*)c[1], line, column);
+        case NODE_FUNCTION_DECLARATION: {
+            FlatNodeId body = flat_ast_child(flat, id, in->child_count - 1);
+            return (ASTNode*)create_function_declaration(arena, (Identifier*)c[0],
+                                                         flat_child_array(flat, id, 1, in->child_count - 2, built, arena),
+                                                         body == FLAT_NODE_NONE ? NULL : (BlockStatement*)built[body],
+                                                         text, line, column);
+        }
+        case NODE_PARAMETER:
+            return (ASTNode*)create_parameter(arena, (Identifier*)c[0], text, (Expression*)c[1], line, column);
+        case NODE_BLOCK_STATEMENT:
+            return (ASTNode*)create_block_statement(arena, flat_child_array(flat, id, 0, in->child_count, built, arena),
+                                                    line, column);
+        case NODE_RETURN_STATEMENT:
+            return (ASTNode*)create_return_statement(arena, (Expression*)c[0], line, column);
+        case NODE_IF_STATEMENT:
+            return (ASTNode*)create_if_statement(arena, (Expression*)c[0], (Statement*)c[1], (Statement*)c[2],
+                                                 line, column);
+        case NODE_WHILE_STATEMENT:
+            return (ASTNode*)create_while_statement(arena, (Expression*)c[0], (Statement*)c[1], line, column);
+        case NODE_FOR_STATEMENT:
+            return (ASTNode*)create_for_statement(arena, c[0], (Expression*)c[1], (Expression*)c[2],
+                                                  (Statement*)c[3], line, column);
+        case NODE_BREAK_STATEMENT:
+            return (ASTNode*)create_break_statement(arena, (Identifier*)c[0], line, column);
+        case NODE_CONTINUE_STATEMENT:
+            return (ASTNode*)create_continue_statement(arena, (Identifier*)c[0], line, column);
+        case NODE_THROW_STATEMENT:
+            return (ASTNode*)create_throw_statement(arena, (Expression*)c[0], line, column);
+        case NODE_TRY_STATEMENT:
+            return (ASTNode*)create_try_statement(arena, (BlockStatement*)c[0], (CatchClause*)c[1],
+                                                  (BlockStatement*)c[2], line, column);
+        case NODE_CATCH_CLAUSE:
+            return (ASTNode*)create_catch_clause(arena, (Identifier*)c[0], (BlockStatement*)c[1], line, column);
+        case NODE_SWITCH_STATEMENT:
+            return (ASTNode*)create_switch_statement(arena, (Expression*)c[0],
+                                                     flat_child_array(flat, id, 1, in->child_count - 1, built, arena),
+                                                     line, column);
+        case NODE_SWITCH_CASE:
+            return (ASTNode*)create_switch_case(arena, (Expression*)c[0],
+                                                flat_child_array(flat, id, 1, in->child_count - 1, built, arena),
+                                                line, column);
+        case NODE_PROGRAM:
+            return (ASTNode*)create_program(arena, flat_child_array(flat, id, 0, in->child_count, built, arena),
+                                            (SourceType)in->kind, line, column);
+    }
+    return NULL;
+}
+
+// Rebuild the pointer tree from its flat encoding, allocating from arena
+// (NULL for heap). Children always have larger ids than their parents, so
+// decoding from the last id backwards builds every child first.
+ASTNode* flat_ast_to_node(const FlatAst* flat, AstArena* arena) {
+    if (!flat || flat->count == 0) return NULL;
+    
+    ASTNode** built = malloc(sizeof(ASTNode*) * flat->count);
+    if (!built) return NULL;
+    for (uint32_t id = flat->count; id-- > 0;) {
+        built[id] = flat_decode_node(flat, id, built, arena);
+    }
+    ASTNode* root = built[flat->root];
+    free(built);
+    return root;
+}
+
+// Bytes held by the encoding
+size_t flat_ast_memory(const FlatAst* flat) {
+    return sizeof(FlatAst) + sizeof(FlatNode) * flat->capacity + sizeof(FlatNodeId) * flat->child_capacity;
+}
+
+void free_flat_ast(FlatAst* flat) {
+    if (!flat) return;
+    
+    free(flat->nodes);
+    free(flat->children);
+    free(flat);
+}
+
+// Binary AST images
+// A tree saved to disk for reuse across runs and loaded back with mmap.
+// Layout: an AstImageHeader, the node records, the child ids, the string
+// table and the string bytes. Node records and child ids are exactly the
+// flat encoding, except that their atom fields hold image string ids:
+// atoms are process-local, so each distinct string is stored once in the
+// image and named by its 1-based position in the string table (0 means
+// none). Every reference is an index or an offset from the start of a
+// section, so a mapped image is read in place with no per-node allocation
+// and no pointer fixups.
+#define AST_IMAGE_MAGIC 0x42545341u    // "ASTB"
+#define AST_IMAGE_VERSION 1
+#define AST_IMAGE_BYTE_ORDER 0x0102u
+
+_Static_assert(sizeof(FlatNode) == 32, "FlatNode is the on-disk node record");
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t byte_order;        // AST_IMAGE_BYTE_ORDER as the writer stored it
+    uint32_t node_count;
+    uint32_t child_total;
+    uint32_t string_count;      // table entries, including the unused entry 0
+    uint32_t root;
+    uint64_t nodes_offset;      // section offsets from the start of the image
+    uint64_t children_offset;
+    uint64_t strings_offset;
+    uint64_t string_data_offset;
+    uint64_t size;              // total image size in bytes
+} AstImageHeader;
+
+typedef struct {
+    uint32_t offset;            // from the start of the string bytes
+    uint32_t length;            // excluding the terminating NUL
+} AstImageString;
+
+typedef struct {
+    const AstImageHeader* header;
+    const FlatNode* nodes;
+    const FlatNodeId* children;
+    const AstImageString* strings;
+    const char* string_data;
+    void* mapping;
+    size_t mapping_length;
+} AstImage;
+
+// Whether a record's value field holds a string rather than a number or flag
+static bool flat_node_has_string_value(const FlatNode* node) {
+    return node->tag == NODE_IDENTIFIER ||
+           (node->tag == NODE_LITERAL && node->kind == LITERAL_STRING);
+}
+
+// Image string id for an atom, assigning the next id on first use
+static uint32_t image_string_id(Atom atom, uint32_t* ids, Atom* atoms, uint32_t* count) {
+    if (atom == ATOM_NONE) return 0;
+    if (ids[atom] == 0) {
+        atoms[*count] = atom;
+        ids[atom] = (*count)++;
+    }
+    return ids[atom];
+}
+
+static bool ast_image_emit(FILE* out, const FlatAst* flat) {
+    // Number the distinct strings in order of first use
+    size_t atom_limit = intern_count() + 1;
+    size_t max_strings = 2 * (size_t)flat->count + 1;
+    uint32_t* ids = calloc(atom_limit, sizeof(uint32_t));
+    Atom* atoms = malloc(sizeof(Atom) * max_strings);
+    if (!ids || !atoms) {
+        free(ids);
+        free(atoms);
+        return false;
+    }
+    uint32_t string_count = 1;
+    atoms[0] = ATOM_NONE;
+    for (uint32_t id = 0; id < flat->count; id++) {
+        const FlatNode* node = &flat->nodes[id];
+        image_string_id(node->text, ids, atoms, &string_count);
+        if (flat_node_has_string_value(node)) image_string_id(node->value.atom, ids, atoms, &string_count);
+    }
+    
+    AstImageHeader header = { 0 };
+    header.magic = AST_IMAGE_MAGIC;
+    header.version = AST_IMAGE_VERSION;
+    header.byte_order = AST_IMAGE_BYTE_ORDER;
+    header.node_count = flat->count;
+    header.child_total = flat->child_total;
+    header.string_count = string_count;
+    header.root = flat->root;
+    header.nodes_offset = sizeof(AstImageHeader);
+    header.children_offset = header.nodes_offset + sizeof(FlatNode) * (uint64_t)flat->count;
+    header.strings_offset = header.children_offset + sizeof(FlatNodeId) * (uint64_t)flat->child_total;
+    header.string_data_offset = header.strings_offset + sizeof(AstImageString) * (uint64_t)string_count;
+    uint64_t data_size = 1;
+    for (uint32_t i = 1; i < string_count; i++) data_size += atom_length(atoms[i]) + 1;
+    header.size = header.string_data_offset + data_size;
+    
+    fwrite(&header, sizeof(header), 1, out);
+    for (uint32_t id = 0; id < flat->count; id++) {
+        FlatNode node = flat->nodes[id];
+        node.text = ids[node.text];
+        if (flat_node_has_string_value(&node)) node.value.atom = ids[node.value.atom];
+        fwrite(&node, sizeof(node), 1, out);
+    }
+    if (flat->child_total > 0) {
+        fwrite(flat->children, sizeof(FlatNodeId), flat->child_total, out);
+    }
+    // Entry 0 names the empty string at offset 0
+    AstImageString entry = { 0, 0 };
+    fwrite(&entry, sizeof(entry), 1, out);
+    entry.offset = 1;
+    for (uint32_t i = 1; i < string_count; i++) {
+        entry.length = (uint32_t)atom_length(atoms[i]);
+        fwrite(&entry, sizeof(entry), 1, out);
+        entry.offset += entry.length + 1;
+    }
+    fputc('\0', out);
+    for (uint32_t i = 1; i < string_count; i++) {
+        fwrite(atom_string(atoms[i]), 1, atom_length(atoms[i]) + 1, out);
+    }
+    
+    free(ids);
+    free(atoms);
+    return !ferror(out);
+}
+
+// Save a program as an image. Writes a temporary file and renames it into
+// place, so readers never map a partial image.
+bool ast_image_write(const Program* program, const char* path) {
+    if (!program || !path) return false;
+    
+    FlatAst* flat = flat_ast_from_node((const ASTNode*)program);
+    if (!flat) return false;
+    
+    size_t tmp_size = strlen(path) + 32;
+    char* tmp = malloc(tmp_size);
+    FILE* out = NULL;
+    if (tmp) {
+        snprintf(tmp, tmp_size, "%s.tmp.%ld", path, (long)getpid());
+        out = fopen(tmp, "wb");
+    }
+    if (!out) {
+        free(tmp);
+        free_flat_ast(flat);
+        return false;
+    }
+    
+    bool ok = ast_image_emit(out, flat);
+    ok &= fclose(out) == 0;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    free(tmp);
+    free_flat_ast(flat);
+    return ok;
+}
+
+// Whether a node of this type may have count child slots
+static bool flat_child_count_valid(NodeType type, uint32_t count) {
+    switch (type) {
+        case NODE_IDENTIFIER:
+        case NODE_LITERAL:
+            return count == 0;
+        case NODE_UNARY_EXPRESSION:
+        case NODE_EXPRESSION_STATEMENT:
+        case NODE_RETURN_STATEMENT:
+        case NODE_BREAK_STATEMENT:
+        case NODE_CONTINUE_STATEMENT:
+        case NODE_THROW_STATEMENT:
+            return count == 1;
+        case NODE_BINARY_EXPRESSION:
+        case NODE_ASSIGNMENT_EXPRESSION:
+        case NODE_MEMBER_EXPRESSION:
+        case NODE_PROPERTY:
+        case NODE_VARIABLE_DECLARATOR:
+        case NODE_PARAMETER:
+        case NODE_WHILE_STATEMENT:
+        case NODE_CATCH_CLAUSE:
+            return count == 2;
+        case NODE_CONDITIONAL_EXPRESSION:
+        case NODE_IF_STATEMENT:
+        case NODE_TRY_STATEMENT:
+            return count == 3;
+        case NODE_FOR_STATEMENT:
+            return count == 4;
+        case NODE_CALL_EXPRESSION:
+        case NODE_SWITCH_STATEMENT:
+        case NODE_SWITCH_CASE:
+            return count >= 1;
+        case NODE_FUNCTION_DECLARATION:
+            return count >= 2;
+        case NODE_ARRAY_EXPRESSION:
+        case NODE_OBJECT_EXPRESSION:
+        case NODE_VARIABLE_DECLARATION:
+        case NODE_BLOCK_STATEMENT:
+        case NODE_PROGRAM:
+            return true;
+    }
+    return false;
+}
+
+// Types a node may hold in child slot `slot` of `count`. *optional is set
+// when the slot may be empty.
+static uint32_t flat_slot_types(NodeType type, uint32_t slot, uint32_t count, bool* optional) {
+    *optional = false;
+    switch (type) {
+        case NODE_OBJECT_EXPRESSION:
+            return NODE_BIT(NODE_PROPERTY);
+        case NODE_VARIABLE_DECLARATION:
+            return NODE_BIT(NODE_VARIABLE_DECLARATOR);
+        case NODE_VARIABLE_DECLARATOR:
+            *optional = slot == 1;
+            return slot == 0 ? NODE_BIT(NODE_IDENTIFIER) : EXPRESSION_TYPES;
+        case NODE_FUNCTION_DECLARATION:
+            if (slot == 0) return NODE_BIT(NODE_IDENTIFIER);
+            return slot == count - 1 ? NODE_BIT(NODE_BLOCK_STATEMENT) : NODE_BIT(NODE_PARAMETER);
+        case NODE_PARAMETER:
+            *optional = slot == 1;
+            return slot == 0 ? NODE_BIT(NODE_IDENTIFIER) : EXPRESSION_TYPES;
+        case NODE_RETURN_STATEMENT:
+            *optional = true;
+            return EXPRESSION_TYPES;
+        case NODE_IF_STATEMENT:
+            *optional = slot == 2;
+            return slot == 0 ? EXPRESSION_TYPES : STATEMENT_TYPES;
+        case NODE_WHILE_STATEMENT:
+            return slot == 0 ? EXPRESSION_TYPES : STATEMENT_TYPES;
+        case NODE_FOR_STATEMENT:
+            *optional = slot < 3;
+            if (slot == 0) return NODE_BIT(NODE_VARIABLE_DECLARATION) | EXPRESSION_TYPES;
+            return slot == 3 ? STATEMENT_TYPES : EXPRESSION_TYPES;
+        case NODE_BREAK_STATEMENT:
+        case NODE_CONTINUE_STATEMENT:
+            *optional = true;
+            return NODE_BIT(NODE_IDENTIFIER);
+        case NODE_TRY_STATEMENT:
+            *optional = slot > 0;
+            return slot == 1 ? NODE_BIT(NODE_CATCH_CLAUSE) : NODE_BIT(NODE_BLOCK_STATEMENT);
+        case NODE_CATCH_CLAUSE:
+            // catch { } binds no name
+            *optional = slot == 0;
+            return slot == 0 ? NODE_BIT(NODE_IDENTIFIER) : NODE_BIT(NODE_BLOCK_STATEMENT);
+        case NODE_SWITCH_STATEMENT:
+            return slot == 0 ? EXPRESSION_TYPES : NODE_BIT(NODE_SWITCH_CASE);
+        case NODE_SWITCH_CASE:
+            *optional = slot == 0;
+            return slot == 0 ? EXPRESSION_TYPES : STATEMENT_TYPES;
+        case NODE_PROGRAM:
+        case NODE_BLOCK_STATEMENT:
+            return STATEMENT_TYPES;
+        default:
+            return EXPRESSION_TYPES;
+    }
+}
+
+// Whether a node's kind byte, and a boolean literal's value byte, hold
+// values its decoder accepts
+static bool flat_kind_valid(const FlatNode* node) {
+    switch ((NodeType)node->tag) {
+        case NODE_LITERAL:
+            return node->kind <= LITERAL_NULL &&
+                   (node->kind != LITERAL_BOOLEAN || *(const uint8_t*)&node->value.boolean <= 1);
+        case NODE_BINARY_EXPRESSION:
+        case NODE_UNARY_EXPRESSION:
+        case NODE_ASSIGNMENT_EXPRESSION: return node->kind < OP_COUNT;
+        case NODE_MEMBER_EXPRESSION: return node->kind <= 1;
+        case NODE_VARIABLE_DECLARATION: return node->kind <= VAR_KIND_CONST;
+        case NODE_PROGRAM: return node->kind <= SOURCE_MODULE;
+        default: return true;
+    }
+}
+
+// Check that a mapped image is well formed before anything reads it: the
+// sections lie inside the file, every string is terminated, each node has
+// a kind its decoder accepts and children of the types its slots hold,
+// with only optional slots empty, and the child ids form a single tree
+// rooted at node 0 in which each node except the root has exactly one
+// parent, with a smaller id.
+static bool ast_image_validate(const char* base, size_t size) {
+    if (size < sizeof(AstImageHeader)) return false;
+    const AstImageHeader* header = (const AstImageHeader*)base;
+    if (header->magic != AST_IMAGE_MAGIC || header->version != AST_IMAGE_VERSION ||
+        header->byte_order != AST_IMAGE_BYTE_ORDER || header->size != size ||
+        header->node_count == 0 || header->root != 0 || header->string_count == 0) {
+        return false;
+    }
+    if (header->nodes_offset % 8 != 0 || header->children_offset % 4 != 0 ||
+        header->strings_offset % 4 != 0 ||
+        header->nodes_offset > size ||
+        (size - header->nodes_offset) / sizeof(FlatNode) < header->node_count ||
+        header->children_offset > size ||
+        (size - header->children_offset) / sizeof(FlatNodeId) < header->child_total ||
+        header->strings_offset > size ||
+        (size - header->strings_offset) / sizeof(AstImageString) < header->string_count ||
+        header->string_data_offset >= size) {
+        return false;
+    }
+    
+    const AstImageString* strings = (const AstImageString*)(base + header->strings_offset);
+    const char* data = base + header->string_data_offset;
+    size_t data_size = size - header->string_data_offset;
+    for (uint32_t i = 0; i < header->string_count; i++) {
+        if (strings[i].offset >= data_size || strings[i].length >= data_size - strings[i].offset ||
+            data[strings[i].offset + strings[i].length] != '\0') {
+            return false;
+        }
+    }
+    
+    const FlatNode* nodes = (const FlatNode*)(base + header->nodes_offset);
+    const FlatNodeId* children = (const FlatNodeId*)(base + header->children_offset);
+    uint8_t* seen = calloc((header->node_count + 7) / 8, 1);
+    if (!seen) return false;
+    bool valid = true;
+    for (uint32_t id = 0; id < header->node_count && valid; id++) {
+        const FlatNode* node = &nodes[id];
+        valid = node->tag < NODE_TYPE_COUNT &&
+                node->first_child <= header->child_total &&
+                node->child_count <= header->child_total - node->first_child &&
+                flat_child_count_valid((NodeType)node->tag, node->child_count) &&
+                flat_kind_valid(node) &&
+                node->text < header->string_count &&
+                (!flat_node_has_string_value(node) || node->value.atom < header->string_count);
+        for (uint32_t i = 0; i < node->child_count && valid; i++) {
+            FlatNodeId child = children[node->first_child + i];
+            bool optional;
+            uint32_t types = flat_slot_types((NodeType)node->tag, i, node->child_count, &optional);
+            if (child == FLAT_NODE_NONE) {
+                valid = optional;
+                continue;
+            }
+            valid = child > id && child < header->node_count && !(seen[child / 8] & (1u << (child % 8)));
+            if (!valid) break;
+            // Children have larger ids, so the child's tag is not checked yet
+            NodeType child_type = (NodeType)nodes[child].tag;
+            valid = nodes[child].tag < NODE_TYPE_COUNT && node_can_contain((NodeType)node->tag, child_type) &&
+                    (types & NODE_BIT(child_type)) != 0;
+            if (valid) seen[child / 8] |= (uint8_t)(1u << (child % 8));
+        }
+    }
+    // Every node but the root must have been claimed by a parent
+    for (uint32_t id = 1; id < header->node_count && valid; id++) {
+        valid = (seen[id / 8] & (1u << (id % 8))) != 0;
+    }
+    free(seen);
+    return valid;
+}
+
+// Map an image for reading. NULL if the file is missing or malformed.
+AstImage* ast_image_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(AstImageHeader)) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    size_t size = (size_t)st.st_size;
+    
+    AstImage* image = ast_image_validate(data, size) ? malloc(sizeof(AstImage)) : NULL;
+    if (!image) {
+        munmap(data, size);
+        return NULL;
+    }
+    
+    const char* base = data;
+    image->header = data;
+    image->nodes = (const FlatNode*)(base + image->header->nodes_offset);
+    image->children = (const FlatNodeId*)(base + image->header->children_offset);
+    image->strings = (const AstImageString*)(base + image->header->strings_offset);
+    image->string_data = base + image->header->string_data_offset;
+    image->mapping = data;
+    image->mapping_length = size;
+    return image;
+}
+
+void ast_image_close(AstImage* image) {
+    if (!image) return;
+    
+    munmap(image->mapping, image->mapping_length);
+    free(image);
+}
+
+// Reader API. Node ids are preorder positions, so the root is 0 and a
+// linear scan from 0 to ast_image_node_count() visits the whole tree
+// depth-first. Strings point into the mapping and live until close.
+uint32_t ast_image_node_count(const AstImage* image) {
+    return image->header->node_count;
+}
+
+const FlatNode* ast_image_node(const AstImage* image, FlatNodeId id) {
+    return &image->nodes[id];
+}
+
+NodeType ast_image_node_type(const AstImage* image, FlatNodeId id) {
+    return (NodeType)image->nodes[id].tag;
+}
+
+size_t ast_image_child_count(const AstImage* image, FlatNodeId id) {
+    return image->nodes[id].child_count;
+}
+
+// Child in ast_child() order; FLAT_NODE_NONE for an absent optional child
+FlatNodeId ast_image_child(const AstImage* image, FlatNodeId id, size_t index) {
+    const FlatNode* node = &image->nodes[id];
+    return index < node->child_count ? image->children[node->first_child + index] : FLAT_NODE_NONE;
+}
+
+// String by image string id; NULL for 0
+const char* ast_image_string(const AstImage* image, uint32_t string_id) {
+    if (string_id == 0 || string_id >= image->header->string_count) return NULL;
+    return image->string_data + image->strings[string_id].offset;
+}
+
+// Identifier name or string literal value
+const char* ast_image_name(const AstImage* image, FlatNodeId id) {
+    const FlatNode* node = &image->nodes[id];
+    return flat_node_has_string_value(node) ? ast_image_string(image, node->value.atom) : NULL;
+}
+
+// Raw literal text, parameter type or return type
+const char* ast_image_text(const AstImage* image, FlatNodeId id) {
+    return ast_image_string(image, image->nodes[id].text);
+}
+
+OperatorKind ast_image_operator(const AstImage* image, FlatNodeId id) {
+    const FlatNode* node = &image->nodes[id];
+    bool has_operator = node->tag == NODE_BINARY_EXPRESSION || node->tag == NODE_UNARY_EXPRESSION ||
+                        node->tag == NODE_ASSIGNMENT_EXPRESSION;
+    return has_operator && node->kind < OP_COUNT ? (OperatorKind)node->kind : OP_NONE;
+}
+
+typedef VisitResult (*AstImageVisitor)(const AstImage* image, FlatNodeId id, FlatNodeId parent, void* data);
+
+typedef struct {
+    FlatNodeId id;
+    FlatNodeId parent;
+    uint32_t next;          // next child to visit
+    uint32_t count;         // 0 when the children are skipped
+} ImageWalkFrame;
+
+// walk_ast() over an image, in place. parent is FLAT_NODE_NONE for the
+// starting node. Returns false if a visitor stopped the walk.
+bool ast_image_walk(const AstImage* image, FlatNodeId root, AstImageVisitor enter, AstImageVisitor exit,
+                    void* data) {
+    if (root >= image->header->node_count) return true;
+    
+    VisitResult result = enter ? enter(image, root, FLAT_NODE_NONE, data) : VISIT_CONTINUE;
+    if (result == VISIT_STOP) return false;
+    
+    ImageWalkFrame inline_stack[WALK_INLINE_DEPTH];
+    ImageWalkFrame* stack = inline_stack;
+    size_t capacity = WALK_INLINE_DEPTH;
+    size_t depth = 0;
+    bool completed = true;
+    
+    stack[depth++] = (ImageWalkFrame){ root, FLAT_NODE_NONE, 0,
+                                       result == VISIT_SKIP_CHILDREN ? 0 : image->nodes[root].child_count };
+    while (depth > 0) {
+        ImageWalkFrame* frame = &stack[depth - 1];
+        if (frame->next < frame->count) {
+            FlatNodeId child = image->children[image->nodes[frame->id].first_child + frame->next++];
+            if (child == FLAT_NODE_NONE) continue;
+            
+            result = enter ? enter(image, child, frame->id, data) : VISIT_CONTINUE;
+            if (result == VISIT_STOP) {
+                completed = false;
+                break;
+            }
+            if (depth == capacity) {
+                ImageWalkFrame* grown = malloc(sizeof(ImageWalkFrame) * capacity * 2);
+                if (!grown) {
+                    completed = false;
+                    break;
+                }
+                memcpy(grown, stack, sizeof(ImageWalkFrame) * depth);
+                if (stack != inline_stack) free(stack);
+                stack = grown;
+                capacity *= 2;
+                frame = &stack[depth - 1];
+            }
+            stack[depth++] = (ImageWalkFrame){ child, frame->id, 0,
+                                               result == VISIT_SKIP_CHILDREN ? 0 : image->nodes[child].child_count };
+            continue;
+        }
+        
+        if (exit && exit(image, frame->id, frame->parent, data) == VISIT_STOP) {
+            completed = false;
+            break;
+        }
+        depth--;
+    }
+    
+    if (stack != inline_stack) free(stack);
+    return completed;
+}
+
+// Materialize the image as a pointer tree allocated from arena (NULL for
+// heap), interning its strings in this process
+ASTNode* ast_image_to_node(const AstImage* image, AstArena* arena) {
+    uint32_t count = image->header->node_count;
+    uint32_t string_count = image->header->string_count;
+    FlatNode* nodes = malloc(sizeof(FlatNode) * count);
+    Atom* atoms = malloc(sizeof(Atom) * string_count);
+    if (!nodes || !atoms) {
+        free(nodes);
+        free(atoms);
+        return NULL;
+    }
+    atoms[0] = ATOM_NONE;
+    for (uint32_t i = 1; i < string_count; i++) {
+        atoms[i] = intern_string_n(image->string_data + image->strings[i].offset, image->strings[i].length);
+    }
+    memcpy(nodes, image->nodes, sizeof(FlatNode) * count);
+    for (uint32_t id = 0; id < count; id++) {
+        nodes[id].text = atoms[nodes[id].text];
+        if (flat_node_has_string_value(&nodes[id])) nodes[id].value.atom = atoms[nodes[id].value.atom];
+    }
+    
+    FlatAst flat = { 0 };
+    flat.nodes = nodes;
+    flat.count = count;
+    flat.capacity = count;
+    flat.children = (FlatNodeId*)image->children;
+    flat.child_total = image->header->child_total;
+    flat.child_capacity = flat.child_total;
+    flat.root = image->header->root;
+    ASTNode* root = flat_ast_to_node(&flat, arena);
+    
+    free(nodes);
+    free(atoms);
+    return root;
+}
+
+// JSON serialization
+// JsonWriter emits JSON into a growable memory buffer, or batches it into
+// large writes to a FILE* or file descriptor. Output is compact, or
+// pretty-printed with two-space indentation.
+typedef enum {
+    JSON_SINK_BUFFER,
+    JSON_SINK_FILE,
+    JSON_SINK_FD
+} JsonSinkKind;
+
+typedef struct {
+    char* data;             // whole output for a buffer sink, pending bytes otherwise
+    size_t length;
+    size_t capacity;
+    JsonSinkKind sink;
+    FILE* file;
+    int fd;
+    bool pretty;
+    bool failed;            // a write to the sink failed
+    bool after_key;         // next value completes a "key": pair
+    int base_indent;
+    bool* has_members;      // per open container: whether it has members yet
+    size_t depth;
+    size_t depth_capacity;
+} JsonWriter;
+
+#define JSON_WRITER_BUFFER_SIZE (64 * 1024)
+
+static JsonWriter* json_writer_create(JsonSinkKind sink, bool pretty) {
+    JsonWriter* writer = calloc(1, sizeof(JsonWriter));
+    if (!writer) return NULL;
+    writer->capacity = JSON_WRITER_BUFFER_SIZE;
+    writer->data = malloc(writer->capacity);
+    if (!writer->data) {
+        free(writer);
+        return NULL;
+    }
+    writer->sink = sink;
+    writer->fd = -1;
+    writer->pretty = pretty;
+    return writer;
+}
+
+JsonWriter* json_writer_create_buffer(bool pretty) {
+    return json_writer_create(JSON_SINK_BUFFER, pretty);
+}
+
+JsonWriter* json_writer_create_file(FILE* file, bool pretty) {
+    JsonWriter* writer = json_writer_create(JSON_SINK_FILE, pretty);
+    if (writer) writer->file = file;
+    return writer;
+}
+
+JsonWriter* json_writer_create_fd(int fd, bool pretty) {
+    JsonWriter* writer = json_writer_create(JSON_SINK_FD, pretty);
+    if (writer) writer->fd = fd;
+    return writer;
+}
+
+static bool json_sink_write(JsonWriter* writer, const char* data, size_t length) {
+    if (writer->sink == JSON_SINK_FILE) {
+        return fwrite(data, 1, length, writer->file) == length;
+    }
+    while (length > 0) {
+        ssize_t written = write(writer->fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+// Hand pending bytes to a FILE* or fd sink; a no-op for buffer sinks.
+// Returns false once any write has failed.
+bool json_writer_flush(JsonWriter* writer) {
+    if (writer->sink != JSON_SINK_BUFFER && writer->length > 0) {
+        if (!writer->failed && !json_sink_write(writer, writer->data, writer->length)) {
+            writer->failed = true;
+        }
+        writer->length = 0;
+    }
+    return !writer->failed;
+}
+
+// Output of a buffer sink, NUL-terminated; owned by the writer
+const char* json_writer_data(JsonWriter* writer, size_t* length) {
+    if (writer->sink != JSON_SINK_BUFFER) return NULL;
+    if (writer->length == writer->capacity) {
+        char* data = realloc(writer->data, writer->capacity + 1);
+        if (!data) return NULL;
+        writer->data = data;
+        writer->capacity++;
+    }
+    writer->data[writer->length] = '\0';
+    if (length) *length = writer->length;
+    return writer->data;
+}
+
+// Flushes, then frees the writer; the sink itself is not closed
+void free_json_writer(JsonWriter* writer) {
+    if (!writer) return;
+    
+    json_writer_flush(writer);
+    free(writer->data);
+    free(writer->has_members);
+    free(writer);
+}
+
+static void json_put(JsonWriter* writer, const char* data, size_t length) {
+    if (writer->capacity - writer->length < length) {
+        if (writer->sink == JSON_SINK_BUFFER) {
+            size_t capacity = writer->capacity * 2;
+            while (capacity - writer->length < length) capacity *= 2;
+            char* grown = realloc(writer->data, capacity);
+            if (!grown) {
+                writer->failed = true;
+                return;
+            }
+            writer->data = grown;
+            writer->capacity = capacity;
+        } else {
+            json_writer_flush(writer);
+            if (length > writer->capacity) {
+                if (!writer->failed && !json_sink_write(writer, data, length)) writer->failed = true;
+                return;
+            }
+        }
+    }
+    memcpy(writer->data + writer->length, data, length);
+    writer->length += length;
+}
+
+static void json_put_char(JsonWriter* writer, char c) {
+    if (writer->length < writer->capacity) {
+        writer->data[writer->length++] = c;
+    } else {
+        json_put(writer, &c, 1);
+    }
+}
+
+static void json_newline(JsonWriter* writer) {
+    static const char spaces[] = "                                                                ";
+    if (!writer->pretty) return;
+    json_put_char(writer, '\n');
+    size_t indent = 2 * (writer->base_indent + writer->depth);
+    while (indent > 0) {
+        size_t chunk = indent < sizeof(spaces) - 1 ? indent : sizeof(spaces) - 1;
+        json_put(writer, spaces, chunk);
+        indent -= chunk;
+    }
+}
+
+// Separator and line break before a member or array element
+static void json_before_value(JsonWriter* writer) {
+    if (writer->after_key) {
+        writer->after_key = false;
+        return;
+    }
+    if (writer->depth == 0) return;
+    if (writer->has_members[writer->depth - 1]) json_put_char(writer, ',');
+    writer->has_members[writer->depth - 1] = true;
+    json_newline(writer);
+}
+
+static void json_open(JsonWriter* writer, char bracket) {
+    json_before_value(writer);
+    json_put_char(writer, bracket);
+    if (writer->depth == writer->depth_capacity) {
+        size_t capacity = writer->depth_capacity ? writer->depth_capacity * 2 : 32;
+        bool* grown = realloc(writer->has_members, sizeof(bool) * capacity);
+        if (!grown) {
+            writer->failed = true;
+            return;
+        }
+        writer->has_members = grown;
+        writer->depth_capacity = capacity;
+    }
+    writer->has_members[writer->depth++] = false;
+}
+
+static void json_close(JsonWriter* writer, char bracket) {
+    if (writer->depth == 0) return;
+    bool had_members = writer->has_members[--writer->depth];
+    if (had_members) json_newline(writer);
+    json_put_char(writer, bracket);
+}
+
+void json_begin_object(JsonWriter* writer) { json_open(writer, '{'); }
+void json_end_object(JsonWriter* writer) { json_close(writer, '}'); }
+void json_begin_array(JsonWriter* writer) { json_open(writer, '['); }
+void json_end_array(JsonWriter* writer) { json_close(writer, ']'); }
+
+static void json_put_escaped(JsonWriter* writer, const char* str, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    json_put_char(writer, '"');
+    size_t run = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        
+        json_put(writer, str + run, i - run);
+        run = i + 1;
+        char escape[6] = { '\\', 0 };
+        size_t escape_length = 2;
+        switch (c) {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                memcpy(escape + 1, "u00", 3);
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xf];
+                escape_length = 6;
+                break;
+        }
+        json_put(writer, escape, escape_length);
+    }
+    json_put(writer, str + run, length - run);
+    json_put_char(writer, '"');
+}
+
+void json_key(JsonWriter* writer, const char* key) {
+    json_before_value(writer);
+    json_put_escaped(writer, key, strlen(key));
+    json_put_char(writer, ':');
+    if (writer->pretty) json_put_char(writer, ' ');
+    writer->after_key = true;
+}
+
+void json_string_n(JsonWriter* writer, const char* str, size_t length) {
+    json_before_value(writer);
+    json_put_escaped(writer, str, length);
+}
+
+void json_string(JsonWriter* writer, const char* str) {
+    json_string_n(writer, str, strlen(str));
+}
+
+void json_null(JsonWriter* writer) {
+    json_before_value(writer);
+    json_put(writer, "null", 4);
+}
+
+void json_bool(JsonWriter* writer, bool value) {
+    json_before_value(writer);
+    if (value) json_put(writer, "true", 4);
+    else json_put(writer, "false", 5);
+}
+
+void json_int(JsonWriter* writer, long long value) {
+    char text[24];
+    int length = snprintf(text, sizeof(text), "%lld", value);
+    json_before_value(writer);
+    json_put(writer, text, (size_t)length);
+}
+
+// Shortest of %.15g/%.17g that reads back exactly; JSON has no NaN or
+// infinity, so those are written as null
+void json_number(JsonWriter* writer, double value) {
+    if (value != value || value - value != 0) {
+        json_null(writer);
+        return;
+    }
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%.15g", value);
+    if (strtod(text, NULL) != value) length = snprintf(text, sizeof(text), "%.17g", value);
+    json_before_value(writer);
+    json_put(writer, text, (size_t)length);
+}
+
+// Field names for each node type's children, in ast_child() order. At
+// most one field per type is a list; it takes whatever children the
+// single fields do not.
+typedef struct {
+    const char* name;
+    bool list;
+} JsonField;
+
+#define JSON_MAX_FIELDS 4
+
+static const JsonField json_fields[NODE_TYPE_COUNT][JSON_MAX_FIELDS] = {
+    [NODE_PROGRAM] = { { "body", true } },
+    [NODE_BINARY_EXPRESSION] = { { "left", false }, { "right", false } },
+    [NODE_UNARY_EXPRESSION] = { { "argument", false } },
+    [NODE_ASSIGNMENT_EXPRESSION] = { { "left", false }, { "right", false } },
+    [NODE_CALL_EXPRESSION] = { { "callee", false }, { "arguments", true } },
+    [NODE_MEMBER_EXPRESSION] = { { "object", false }, { "property", false } },
+    [NODE_ARRAY_EXPRESSION] = { { "elements", true } },
+    [NODE_OBJECT_EXPRESSION] = { { "properties", true } },
+    [NODE_PROPERTY] = { { "key", false }, { "value", false } },
+    [NODE_CONDITIONAL_EXPRESSION] = { { "test", false }, { "consequent", false }, { "alternate", false } },
+    [NODE_EXPRESSION_STATEMENT] = { { "expression", false } },
+    [NODE_VARIABLE_DECLARATION] = { { "declarations", true } },
+    [NODE_VARIABLE_DECLARATOR] = { { "id", false }, { "init", false } },
+    [NODE_FUNCTION_DECLARATION] = { { "id", false }, { "params", true }, { "body", false } },
+    [NODE_PARAMETER] = { { "name", false }, { "defaultValue", false } },
+    [NODE_BLOCK_STATEMENT] = { { "body", true } },
+    [NODE_RETURN_STATEMENT] = { { "argument", false } },
+    [NODE_IF_STATEMENT] = { { "test", false }, { "consequent", false }, { "alternate", false } },
+    [NODE_WHILE_STATEMENT] = { { "test", false }, { "body", false } },
+    [NODE_FOR_STATEMENT] = { { "init", false }, { "test", false }, { "update", false }, { "body", false } },
+    [NODE_BREAK_STATEMENT] = { { "label", false } },
+    [NODE_CONTINUE_STATEMENT] = { { "label", false } },
+    [NODE_THROW_STATEMENT] = { { "argument", false } },
+    [NODE_TRY_STATEMENT] = { { "block", false }, { "handler", false }, { "finalizer", false } },
+    [NODE_CATCH_CLAUSE] = { { "param", false }, { "body", false } },
+    [NODE_SWITCH_STATEMENT] = { { "discriminant", false }, { "cases", true } },
+    [NODE_SWITCH_CASE] = { { "test", false }, { "consequent", true } }
+};
+
+// Open a node's object and write everything but its children
+static void json_write_node_head(JsonWriter* writer, const ASTNode* node) {
+    json_begin_object(writer);
+    json_key(writer, "type");
+    json_string(writer, node_type_to_string(node->type));
+    if (node->line > 0) {
+        json_key(writer, "line");
+        json_int(writer, node->line);
+    }
+    if (node->column > 0) {
+        json_key(writer, "column");
+        json_int(writer, node->column);
+    }
+    
+    switch (node->type) {
+        case NODE_IDENTIFIER: {
+            const Identifier* id = (const Identifier*)node;
+            json_key(writer, "name");
+            json_string_n(writer, id->name ? id->name : "", atom_length(id->atom));
+            break;
+        }
+        case NODE_LITERAL: {
+            const Literal* lit = (const Literal*)node;
+            json_key(writer, "value");
+            switch (lit->literal_type) {
+                case LITERAL_STRING:
+                    json_string_n(writer, lit->value.string_value ? lit->value.string_value : "",
+                                  atom_length(lit->atom));
+                    break;
+                case LITERAL_NUMBER:
+                    json_number(writer, lit->value.number_value);
+                    break;
+                case LITERAL_BOOLEAN:
+                    json_bool(writer, lit->value.boolean_value);
+                    break;
+                case LITERAL_NULL:
+                    json_null(writer);
+                    break;
+            }
+            if (lit->raw) {
+                json_key(writer, "raw");
+                json_string(writer, lit->raw);
+            }
+            break;
+        }
+        case NODE_BINARY_EXPRESSION:
+            json_key(writer, "operator");
+            json_string(writer, operator_to_string(((const BinaryExpression*)node)->operator));
+            break;
+        case NODE_UNARY_EXPRESSION:
+            json_key(writer, "operator");
+            json_string(writer, operator_to_string(((const UnaryExpression*)node)->operator));
+            break;
+        case NODE_ASSIGNMENT_EXPRESSION:
+            json_key(writer, "operator");
+            json_string(writer, operator_to_string(((const AssignmentExpression*)node)->operator));
+            break;
+        case NODE_MEMBER_EXPRESSION:
+            json_key(writer, "computed");
+            json_bool(writer, ((const MemberExpression*)node)->computed);
+            break;
+        case NODE_VARIABLE_DECLARATION: {
+            VariableKind kind = ((const VariableDeclaration*)node)->kind;
+            json_key(writer, "kind");
+            json_string(writer, kind == VAR_KIND_VAR ? "var" : kind == VAR_KIND_LET ? "let" : "const");
+            break;
+        }
+        case NODE_PARAMETER: {
+            const Parameter* param = (const Parameter*)node;
+            if (param->param_type) {
+                json_key(writer, "paramType");
+                json_string(writer, param->param_type);
+            }
+            break;
+        }
+        case NODE_FUNCTION_DECLARATION: {
+            const FunctionDeclaration* func = (const FunctionDeclaration*)node;
+            if (func->return_type) {
+                json_key(writer, "returnType");
+                json_string(writer, func->return_type);
+            }
+            break;
+        }
+        case NODE_PROGRAM:
+            json_key(writer, "sourceType");
+            json_string(writer, ((const Program*)node)->source_type == SOURCE_SCRIPT ? "script" : "module");
+            break;
+        default:
+            break;
+    }
+}
+
+typedef struct {
+    const ASTNode* node;
+    size_t child;           // next ast_child() index
+    size_t child_count;
+    int field;              // current entry in json_fields
+    size_t list_remaining;  // children left in an open list field
+    bool in_list;
+} JsonFrame;
+
+// Serialize a tree. Absent optional children are omitted; list fields
+// are always written. Uses an explicit stack, so any depth works.
+// Returns false if the writer's sink failed.
+bool json_write_ast(JsonWriter* writer, const ASTNode* root) {
+    if (!root) {
+        json_null(writer);
+        return !writer->failed;
+    }
+    
+    size_t capacity = 64;
+    size_t depth = 0;
+    JsonFrame* stack = malloc(sizeof(JsonFrame) * capacity);
+    if (!stack) return false;
+    
+    json_write_node_head(writer, root);
+    stack[depth++] = (JsonFrame){ root, 0, ast_child_count(root), 0, 0, false };
+    while (depth > 0 && !writer->failed) {
+        JsonFrame* frame = &stack[depth - 1];
+        const JsonField* field = frame->field < JSON_MAX_FIELDS
+            ? &json_fields[frame->node->type][frame->field] : NULL;
+        if (!field || !field->name) {
+            json_end_object(writer);
+            depth--;
+            continue;
+        }
+        
+        const ASTNode* child = NULL;
+        if (field->list) {
+            if (!frame->in_list) {
+                // The list holds every child the remaining single fields do not
+                size_t singles = 0;
+                for (int f = frame->field + 1; f < JSON_MAX_FIELDS && json_fields[frame->node->type][f].name; f++) {
+                    singles++;
+                }
+                frame->list_remaining = frame->child_count - frame->child - singles;
+                frame->in_list = true;
+                json_key(writer, field->name);
+                json_begin_array(writer);
+            }
+            if (frame->list_remaining == 0) {
+                json_end_array(writer);
+                frame->in_list = false;
+                frame->field++;
+                continue;
+            }
+            frame->list_remaining--;
+            child = ast_child(frame->node, frame->child++);
+            if (!child) {
+                json_null(writer);
+                continue;
+            }
+        } else {
+            frame->field++;
+            child = ast_child(frame->node, frame->child++);
+            if (!child) continue;
+            json_key(writer, field->name);
+        }
+        
+        if (depth == capacity) {
+            JsonFrame* grown = realloc(stack, sizeof(JsonFrame) * capacity * 2);
+            if (!grown) {
+                writer->failed = true;
+                break;
+            }
+            stack = grown;
+            capacity *= 2;
+        }
+        json_write_node_head(writer, child);
+        stack[depth++] = (JsonFrame){ child, 0, ast_child_count(child), 0, 0, false };
+    }
+    free(stack);
+    return !writer->failed;
+}
+
+// Pretty JSON for a tree on stdout, starting at the given indent level
+void ast_to_json(ASTNode* node, int indent) {
+    JsonWriter* writer = json_writer_create_file(stdout, true);
+    if (!writer) return;
+    writer->base_indent = indent;
+    json_write_ast(writer, node);
+    free_json_writer(writer);
+}
+
+// Example usage function
+// Defined with the passes below the demo
+ASTNode* clone_ast_node(AstArena* arena, ASTNode* node);
+ASTNode* ast_replace_subtree(AstArena* arena, ASTNode* root, const ASTNode* target, ASTNode* replacement);
+size_t fold_constants(AstArena* arena, ASTNode** root);
+size_t eliminate_dead_code(Program* program);
+
+void demonstrate_ast() {
+    printf("=== AST Demo ===\n\n");
+    
+    // Every node of the demo program is allocated from one arena
+    AstArena* arena = ast_arena_create();
+    
+    // Create identifiers
+    Identifier* x_id = create_identifier(arena, "x", 1, 1);
+    Identifier* a_id = create_identifier(arena, "a", 3, 15);
+    Identifier* b_id = create_identifier(arena, "b", 3, 25);
+    Identifier* add_id = create_identifier(arena, "add", 3, 10);
+    
+    // Create literals
+    Literal* num_42 = create_literal_number(arena, 42.0, "42", 1, 7);
+    
+    // Create variable declarator and declaration
+    VariableDeclarator* x_declarator = create_variable_declarator(arena, x_id, (Expression*)num_42, 1, 5);
+    Array* var_declarations = array_create_in(arena, 1);
+    array_push(var_declarations, x_declarator);
+    VariableDeclaration* var_decl = create_variable_declaration(arena, var_declarations, VAR_KIND_LET, 1, 1);
+    
     // Create function parameters
-    Parameter* param_a = create_parameter(a_id, "number", NULL, 3, 15);
-    Parameter* param_b = create_parameter(b_id, "number", NULL, 3, 25);
-    Array* func_params = array_create(2);
+    Parameter* param_a = create_parameter(arena, a_id, "number", NULL, 3, 15);
+    Parameter* param_b = create_parameter(arena, b_id, "number", NULL, 3, 25);
+    Array* func_params = array_create_in(arena, 2);
     array_push(func_params, param_a);
     array_push(func_params, param_b);
     
     // Create binary expression for a + b
-    Identifier* a_ref = create_identifier("a", 4, 12);
-    Identifier* b_ref = create_identifier("b", 4, 16);
-    BinaryExpression* add_expr = create_binary_expression("+", (Expression*)a_ref, (Expression*)b_ref, 4, 14);
+    Identifier* a_ref = create_identifier(arena, "a", 4, 12);
+    Identifier* b_ref = create_identifier(arena, "b", 4, 16);
+    BinaryExpression* add_expr = create_binary_expression(arena, OP_ADD, (Expression*)a_ref, (Expression*)b_ref, 4, 14);
     
     // Create return statement
-    ReturnStatement* return_stmt = create_return_statement((Expression*)add_expr, 4, 5);
+    ReturnStatement* return_stmt = create_return_statement(arena, (Expression*)add_expr, 4, 5);
     
     // Create block statement for function body
-    Array* func_body = array_create(1);
+    Array* func_body = array_create_in(arena, 1);
     array_push(func_body, return_stmt);
-    BlockStatement* block = create_block_statement(func_body, 3, 35);
+    BlockStatement* block = create_block_statement(arena, func_body, 3, 35);
     
     // Create function declaration
-    FunctionDeclaration* func_decl = create_function_declaration(add_id, func_params, block, "number", 3, 1);
+    FunctionDeclaration* func_decl = create_function_declaration(arena, add_id, func_params, block, "number", 3, 1);
     
     // Create program
-    Array* program_body = array_create(2);
+    Array* program_body = array_create_in(arena, 2);
     array_push(program_body, var_decl);
     array_push(program_body, func_decl);
-    Program* program = create_program(program_body, SOURCE_SCRIPT, 0, 0);
+    Program* program = create_program(arena, program_body, SOURCE_SCRIPT, 0, 0);
     
     // Demonstrate functionality
     printf("1. AST Structure:\n");
@@ -911,6 +3622,8 @@ void demonstrate_ast() {
         Identifier* id = (Identifier*)identifiers->items[i];
         printf("   %s\n", id->name);
     }
+    printf("   (parameter a and reference a share atom: %s)\n",
+           identifier_equals(a_id, a_ref) ? "yes" : "no");
     printf("\n");
     
     printf("3. Function Declarations:\n");
@@ -932,271 +3645,1114 @@ void demonstrate_ast() {
     }
     printf("\n");
     
+    printf("5. Arena:\n");
+    printf("   %zu bytes in %zu chunk(s)\n", arena->bytes_used, arena->chunk_count);
+    printf("\n");
+    
+    printf("6. Flat Encoding:\n");
+    FlatAst* flat = flat_ast_from_node((ASTNode*)program);
+    printf("   %u nodes, %u child slots, %zu bytes\n", flat->count, flat->child_total, flat_ast_memory(flat));
+    ASTNode* decoded = flat_ast_to_node(flat, NULL);
+    FlatAst* reencoded = flat_ast_from_node(decoded);
+    printf("   round trip: %u nodes\n", reencoded->count);
+    printf("\n");
+    free_flat_ast(reencoded);
+    free_flat_ast(flat);
+    free_ast_node(decoded);
+    
+    printf("7. Node Index:\n");
+    program_build_index(program);
+    NodeType wanted[] = { NODE_IDENTIFIER, NODE_PARAMETER, NODE_RETURN_STATEMENT };
+    Array* found[3];
+    find_nodes_by_types((ASTNode*)program, wanted, 3, found);
+    for (size_t i = 0; i < 3; i++) {
+        printf("   %s: %zu\n", node_type_to_string(wanted[i]), found[i]->count);
+        array_free(found[i]);
+    }
+    printf("\n");
+    
+    printf("8. Compact JSON:\n");
+    JsonWriter* json = json_writer_create_buffer(false);
+    json_write_ast(json, (ASTNode*)var_decl);
+    printf("   %s\n", json_writer_data(json, NULL));
+    printf("\n");
+    free_json_writer(json);
+    
+    printf("9. Binary Image:\n");
+    char image_path[64];
+    snprintf(image_path, sizeof(image_path), "/tmp/ast-demo-%ld.astb", (long)getpid());
+    if (ast_image_write(program, image_path)) {
+        AstImage* image = ast_image_open(image_path);
+        if (image) {
+            printf("   %u nodes, %zu bytes\n", ast_image_node_count(image), image->mapping_length);
+            for (FlatNodeId id = 0; id < ast_image_node_count(image); id++) {
+                if (ast_image_node_type(image, id) == NODE_FUNCTION_DECLARATION) {
+                    printf("   function %s\n", ast_image_name(image, ast_image_child(image, id, 0)));
+                }
+            }
+            ast_image_close(image);
+        }
+        unlink(image_path);
+    }
+    printf("\n");
+    
+    printf("10. Hash-Consing:\n");
+    AstArena* shared = ast_arena_create();
+    ast_arena_enable_hash_consing(shared);
+    Expression* products[2];
+    for (int i = 0; i < 2; i++) {
+        products[i] = (Expression*)create_binary_expression(shared, OP_MUL,
+                                                           (Expression*)create_identifier(shared, "a", 20, 1 + i * 8),
+                                                           (Expression*)create_identifier(shared, "b", 20, 5 + i * 8),
+                                                           20, 1 + i * 8);
+    }
+    printf("   a * b built twice: %s node, %zu shared\n", products[0] == products[1] ? "one" : "two",
+           ast_arena_shared_count(shared));
+    printf("   equal to a + b: %s\n", ast_equal((ASTNode*)products[0], (ASTNode*)add_expr) ? "yes" : "no");
+    printf("\n");
+    ast_arena_destroy(shared);
+    
+    printf("11. Clone and Persistent Edit:\n");
+    ASTNode* add_copy = clone_ast_node(NULL, (ASTNode*)func_decl);
+    printf("   clone of add: %s nodes, equal: %s\n", add_copy != (ASTNode*)func_decl ? "new" : "same",
+           ast_equal(add_copy, (ASTNode*)func_decl) ? "yes" : "no");
+    free_ast_node(add_copy);
+    AstArena* versions = ast_arena_create();
+    Literal* num_7 = create_literal_number(versions, 7.0, "7", 1, 7);
+    Program* edited = (Program*)ast_replace_subtree(versions, (ASTNode*)program, (ASTNode*)num_42, (ASTNode*)num_7);
+    VariableDeclarator* edited_x = ((VariableDeclaration*)edited->body.items[0])->declarations.items[0];
+    printf("   x = %g in the new version, %g in the original\n",
+           ((Literal*)edited_x->init)->value.number_value, num_42->value.number_value);
+    printf("   add shared between versions: %s\n", edited->body.items[1] == (void*)func_decl ? "yes" : "no");
+    printf("\n");
+    ast_arena_destroy(versions);
+    
+    printf("12. Constant Folding:\n");
+    Expression* hour = (Expression*)create_binary_expression(NULL, OP_MUL,
+                                                             (Expression*)create_literal_number(NULL, 60, "60", 30, 12),
+                                                             (Expression*)create_literal_number(NULL, 60, "60", 30, 17),
+                                                             30, 15);
+    ASTNode* day = (ASTNode*)create_binary_expression(NULL, OP_MUL, hour,
+                                                      (Expression*)create_literal_number(NULL, 24, "24", 30, 22),
+                                                      30, 20);
+    size_t folds = fold_constants(NULL, &day);
+    printf("   60 * 60 * 24 -> %s (%zu folds)\n", ((Literal*)day)->raw, folds);
+    free_ast_node(day);
+    AstArena* consed = ast_arena_create();
+    ast_arena_enable_hash_consing(consed);
+    ASTNode* shared_and = (ASTNode*)create_binary_expression(consed, OP_LOGICAL_AND,
+                                                             (Expression*)create_literal_boolean(consed, true, "true", 31, 1),
+                                                             (Expression*)create_identifier(consed, "y", 31, 9),
+                                                             31, 6);
+    printf("   true && y in a hash-consing arena: %zu folds (left alone)\n", fold_constants(consed, &shared_and));
+    printf("\n");
+    ast_arena_destroy(consed);
+    
+    printf("13. Dead Code Elimination:\n");
+    // function main(p) { helper(); return; helper(); }
+    // function helper() {}  function unused() {}
+    // var scratch = 1;  var copy = p;  if (copy) var unread = 2;
+    Array* main_params = array_create(1);
+    array_push(main_params, create_parameter(NULL, create_identifier(NULL, "p", 40, 15), NULL, NULL, 40, 15));
+    Array* main_body = array_create(3);
+    for (int i = 0; i < 2; i++) {
+        CallExpression* call = create_call_expression(NULL, (Expression*)create_identifier(NULL, "helper", 41 + i, 5),
+                                                      array_create(1), 41 + i, 5);
+        array_push(main_body, create_expression_statement(NULL, (Expression*)call, 41 + i, 5));
+        if (i == 0) array_push(main_body, create_return_statement(NULL, NULL, 41, 15));
+    }
+    Array* dce_body = array_create(5);
+    array_push(dce_body, create_function_declaration(NULL, create_identifier(NULL, "main", 40, 10), main_params,
+                                                     create_block_statement(NULL, main_body, 40, 18), NULL, 40, 1));
+    const char* empty_functions[] = { "helper", "unused" };
+    for (int i = 0; i < 2; i++) {
+        array_push(dce_body, create_function_declaration(NULL, create_identifier(NULL, empty_functions[i], 44 + i, 10),
+                                                         array_create(1), create_block_statement(NULL, array_create(1), 44 + i, 20),
+                                                         NULL, 44 + i, 1));
+    }
+    const char* dce_names[] = { "scratch", "copy" };
+    Expression* dce_inits[] = { (Expression*)create_literal_number(NULL, 1, "1", 46, 15),
+                                (Expression*)create_identifier(NULL, "p", 47, 12) };
+    for (int i = 0; i < 2; i++) {
+        Array* declarators = array_create(1);
+        array_push(declarators, create_variable_declarator(NULL, create_identifier(NULL, dce_names[i], 46 + i, 5),
+                                                           dce_inits[i], 46 + i, 5));
+        array_push(dce_body, create_variable_declaration(NULL, declarators, VAR_KIND_VAR, 46 + i, 1));
+    }
+    Array* unread_declarators = array_create(1);
+    array_push(unread_declarators, create_variable_declarator(NULL, create_identifier(NULL, "unread", 48, 15),
+                                                              (Expression*)create_literal_number(NULL, 2, "2", 48, 24),
+                                                              48, 15));
+    array_push(dce_body, create_if_statement(NULL, (Expression*)create_identifier(NULL, "copy", 48, 5),
+                                             (Statement*)create_variable_declaration(NULL, unread_declarators,
+                                                                                     VAR_KIND_VAR, 48, 11),
+                                             NULL, 48, 1));
+    Program* dce_program = create_program(NULL, dce_body, SOURCE_SCRIPT, 40, 1);
+    printf("   removed %zu:", eliminate_dead_code(dce_program));
+    for (size_t i = 0; i < dce_program->body.count; i++) {
+        ASTNode* statement = dce_program->body.items[i];
+        if (statement->type == NODE_FUNCTION_DECLARATION) {
+            printf(" %s()", ((FunctionDeclaration*)statement)->id->name);
+        } else if (statement->type == NODE_VARIABLE_DECLARATION) {
+            VariableDeclarator* declarator = ((VariableDeclaration*)statement)->declarations.items[0];
+            printf(" var %s", declarator->id->name);
+        } else if (statement->type == NODE_IF_STATEMENT) {
+            // The emptied declaration leaves an empty block, not `var;`
+            printf(" if (copy) %s", node_type_to_string(((IfStatement*)statement)->consequent->base.type));
+        }
+    }
+    printf(" left; main has %zu statements\n",
+           ((FunctionDeclaration*)dce_program->body.items[0])->body->body.count);
+    printf("\n");
+    free_ast_node((ASTNode*)dce_program);
+    
     // Cleanup
     array_free(identifiers);
     array_free(functions);
     array_free(variables);
-    free_ast_node((ASTNode*)program);
+    free_ast_node((ASTNode*)program); // releases the arena
 }
 
-// JSON serialization functions
-void print_json_indent(int indent) {
-    for (int i = 0; i < indent; i++) {
-        printf("  ");
+// AST cloning
+static size_t ast_node_size(NodeType type) {
+    switch (type) {
+        case NODE_PROGRAM: return sizeof(Program);
+        case NODE_IDENTIFIER: return sizeof(Identifier);
+        case NODE_LITERAL: return sizeof(Literal);
+        case NODE_BINARY_EXPRESSION: return sizeof(BinaryExpression);
+        case NODE_UNARY_EXPRESSION: return sizeof(UnaryExpression);
+        case NODE_ASSIGNMENT_EXPRESSION: return sizeof(AssignmentExpression);
+        case NODE_CALL_EXPRESSION: return sizeof(CallExpression);
+        case NODE_MEMBER_EXPRESSION: return sizeof(MemberExpression);
+        case NODE_ARRAY_EXPRESSION: return sizeof(ArrayExpression);
+        case NODE_OBJECT_EXPRESSION: return sizeof(ObjectExpression);
+        case NODE_PROPERTY: return sizeof(Property);
+        case NODE_CONDITIONAL_EXPRESSION: return sizeof(ConditionalExpression);
+        case NODE_EXPRESSION_STATEMENT: return sizeof(ExpressionStatement);
+        case NODE_VARIABLE_DECLARATION: return sizeof(VariableDeclaration);
+        case NODE_VARIABLE_DECLARATOR: return sizeof(VariableDeclarator);
+        case NODE_FUNCTION_DECLARATION: return sizeof(FunctionDeclaration);
+        case NODE_PARAMETER: return sizeof(Parameter);
+        case NODE_BLOCK_STATEMENT: return sizeof(BlockStatement);
+        case NODE_RETURN_STATEMENT: return sizeof(ReturnStatement);
+        case NODE_IF_STATEMENT: return sizeof(IfStatement);
+        case NODE_WHILE_STATEMENT: return sizeof(WhileStatement);
+        case NODE_FOR_STATEMENT: return sizeof(ForStatement);
+        case NODE_BREAK_STATEMENT: return sizeof(BreakStatement);
+        case NODE_CONTINUE_STATEMENT: return sizeof(ContinueStatement);
+        case NODE_THROW_STATEMENT: return sizeof(ThrowStatement);
+        case NODE_TRY_STATEMENT: return sizeof(TryStatement);
+        case NODE_CATCH_CLAUSE: return sizeof(CatchClause);
+        case NODE_SWITCH_STATEMENT: return sizeof(SwitchStatement);
+        case NODE_SWITCH_CASE: return sizeof(SwitchCase);
     }
+    return sizeof(ASTNode);
 }
 
-void ast_to_json(ASTNode* node, int indent) {
-    if (!node) {
-        printf("null");
-        return;
+// Give a copied array its own items
+static void copy_array_items(AstArena* arena, Array* arr) {
+    void** items = NULL;
+    if (arr->count > 0) {
+        items = arena ? ast_arena_alloc(arena, sizeof(void*) * arr->count) : malloc(sizeof(void*) * arr->count);
+        memcpy(items, arr->items, sizeof(void*) * arr->count);
+    }
+    arr->items = items;
+    arr->capacity = arr->count;
+    arr->arena = arena;
+}
+
+// Copy one node record. The copy owns its strings and child arrays but
+// still points at the original's children until they are replaced.
+static ASTNode* copy_node_record(AstArena* arena, const ASTNode* node) {
+    size_t size = ast_node_size(node->type);
+    ASTNode* copy = arena ? ast_arena_alloc(arena, size) : malloc(size);
+    memcpy(copy, node, size);
+    copy->flags = arena ? AST_FLAG_ARENA : 0;
+    copy->parent = NULL;
+    
+    switch (copy->type) {
+        case NODE_LITERAL: {
+            Literal* lit = (Literal*)copy;
+            lit->raw = ast_strdup(arena, lit->raw);
+            break;
+        }
+        case NODE_PARAMETER: {
+            Parameter* param = (Parameter*)copy;
+            param->param_type = ast_strdup(arena, param->param_type);
+            break;
+        }
+        case NODE_FUNCTION_DECLARATION: {
+            FunctionDeclaration* func = (FunctionDeclaration*)copy;
+            func->return_type = ast_strdup(arena, func->return_type);
+            copy_array_items(arena, &func->params);
+            break;
+        }
+        case NODE_CALL_EXPRESSION:
+            copy_array_items(arena, &((CallExpression*)copy)->arguments);
+            break;
+        case NODE_ARRAY_EXPRESSION:
+            copy_array_items(arena, &((ArrayExpression*)copy)->elements);
+            break;
+        case NODE_OBJECT_EXPRESSION:
+            copy_array_items(arena, &((ObjectExpression*)copy)->properties);
+            break;
+        case NODE_VARIABLE_DECLARATION:
+            copy_array_items(arena, &((VariableDeclaration*)copy)->declarations);
+            break;
+        case NODE_BLOCK_STATEMENT:
+            copy_array_items(arena, &((BlockStatement*)copy)->body);
+            break;
+        case NODE_SWITCH_STATEMENT:
+            copy_array_items(arena, &((SwitchStatement*)copy)->cases);
+            break;
+        case NODE_SWITCH_CASE:
+            copy_array_items(arena, &((SwitchCase*)copy)->consequent);
+            break;
+        case NODE_PROGRAM: {
+            // Like create_program(), a copied program owns its arena
+            Program* program = (Program*)copy;
+            copy_array_items(arena, &program->body);
+            program->arena = arena;
+            program->index = NULL;
+            break;
+        }
+        default:
+            break;
     }
+    return copy;
+}
+
+typedef struct {
+    const ASTNode* node;    // original
+    ASTNode* parent;        // copy whose child slot receives this node's copy
+    size_t index;
+} CloneWork;
+
+// Deep copy of a subtree of any node type, allocated from arena (NULL for
+// heap). Each record is copied whole with memcpy and then has its child
+// pointers relocated to the copies, on an explicit stack, so depth is not
+// limited by the C stack. With an arena the copies are laid out
+// contiguously in preorder. Shared (hash-consed) subtrees are copied once
+// per use, so the copy is always a tree.
+ASTNode* clone_ast_node(AstArena* arena, ASTNode* node) {
+    if (!node) return NULL;
     
-    printf("{\n");
-    print_json_indent(indent + 1);
-    printf("\"type\": \"%s\"", node_type_to_string(node->type));
+    size_t capacity = WALK_INLINE_DEPTH;
+    size_t depth = 0;
+    CloneWork* stack = malloc(sizeof(CloneWork) * capacity);
+    if (!stack) return NULL;
     
-    if (node->line > 0) {
-        printf(",\n");
-        print_json_indent(indent + 1);
-        printf("\"line\": %d", node->line);
+    ASTNode* root = NULL;
+    stack[depth++] = (CloneWork){ node, NULL, 0 };
+    while (depth > 0) {
+        CloneWork work = stack[--depth];
+        ASTNode* copy = copy_node_record(arena, work.node);
+        if (work.parent) ast_set_child(work.parent, work.index, copy);
+        else root = copy;
+        
+        size_t count = ast_child_count(work.node);
+        if (depth + count > capacity) {
+            while (depth + count > capacity) capacity *= 2;
+            CloneWork* grown = realloc(stack, sizeof(CloneWork) * capacity);
+            if (!grown) {
+                // Cut the copy off at the children not yet copied
+                for (size_t i = 0; i < depth; i++) ast_set_child(stack[i].parent, stack[i].index, NULL);
+                for (size_t i = 0; i < count; i++) ast_set_child(copy, i, NULL);
+                depth = 0;
+                break;
+            }
+            stack = grown;
+        }
+        // Push in reverse so children are copied in source order
+        for (size_t i = count; i-- > 0;) {
+            const ASTNode* child = ast_child(work.node, i);
+            if (child) stack[depth++] = (CloneWork){ child, copy, i };
+        }
     }
     
-    if (node->column > 0) {
-        printf(",\n");
-        print_json_indent(indent + 1);
-        printf("\"column\": %d", node->column);
+    free(stack);
+    return root;
+}
+
+// Persistent trees
+// Edits that leave the original untouched: the edited version copies only
+// the nodes on the path from the root to the change and shares every
+// other subtree with the original. Versions must be built in an arena,
+// since their nodes cannot be freed one by one, and the original must
+// outlive them. Release versions by destroying the arena.
+
+// Copy of node with its index-th child replaced; the other children are
+// shared with node
+ASTNode* ast_with_child(AstArena* arena, const ASTNode* node, size_t index, ASTNode* child) {
+    if (!arena || !node || index >= ast_child_count(node)) return NULL;
+    
+    ASTNode* copy = copy_node_record(arena, node);
+    ast_set_child(copy, index, child);
+    return copy;
+}
+
+typedef struct {
+    const ASTNode* target;
+    Array* path;            // nodes from the root down to the current one
+    bool found;
+} PathData;
+
+static VisitResult path_enter(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    PathData* path_data = data;
+    array_push(path_data->path, node);
+    if (node == path_data->target) {
+        path_data->found = true;
+        return VISIT_STOP;
     }
+    return VISIT_CONTINUE;
+}
+
+static VisitResult path_exit(ASTNode* node, ASTNode* parent, void* data) {
+    (void)node;
+    (void)parent;
+    ((PathData*)data)->path->count--;
+    return VISIT_CONTINUE;
+}
+
+// New version of root with target replaced by replacement (which may be
+// NULL for an optional child). NULL if target is not in the tree.
+ASTNode* ast_replace_subtree(AstArena* arena, ASTNode* root, const ASTNode* target, ASTNode* replacement) {
+    if (!arena || !root || !target) return NULL;
+    if (root == target) return replacement;
     
-    // Add node-specific fields
-    switch (node->type) {
-        case NODE_IDENTIFIER: {
-            Identifier* id = (Identifier*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"name\": \"%s\"", id->name);
-            break;
+    PathData data = { target, array_create(16), false };
+    walk_ast(root, path_enter, path_exit, &data);
+    
+    // Copy the ancestors bottom-up, each pointing at the copy below it
+    ASTNode* version = NULL;
+    if (data.found) {
+        ASTNode* child = (ASTNode*)target;
+        ASTNode* updated = replacement;
+        for (size_t i = data.path->count - 1; i-- > 0;) {
+            ASTNode* ancestor = data.path->items[i];
+            size_t index = 0;
+            while (ast_child(ancestor, index) != child) index++;
+            updated = ast_with_child(arena, ancestor, index, updated);
+            child = ancestor;
         }
-        case NODE_LITERAL: {
-            Literal* lit = (Literal*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"value\": ");
-            switch (lit->literal_type) {
-                case LITERAL_STRING:
-                    printf("\"%s\"", lit->value.string_value);
-                    break;
-                case LITERAL_NUMBER:
-                    printf("%g", lit->value.number_value);
-                    break;
-                case LITERAL_BOOLEAN:
-                    printf("%s", lit->value.boolean_value ? "true" : "false");
-                    break;
-                case LITERAL_NULL:
-                    printf("null");
-                    break;
-            }
-            if (lit->raw) {
-                printf(",\n");
-                print_json_indent(indent + 1);
-                printf("\"raw\": \"%s\"", lit->raw);
-            }
+        version = updated;
+    }
+    array_free(data.path);
+    return version;
+}
+
+// Constant folding
+// Rewrites expressions whose value is known from literals, in place:
+// - arithmetic, bitwise, comparison and equality operators on literal
+//   operands become a Literal;
+// - unary -, +, ~ and ! on a literal become a Literal;
+// - && and || with a literal left operand become the operand that decides
+//   the result;
+// - exact numeric identities (x - 0, x * 1, 1 * x, x / 1 for numeric x)
+//   and !!x in a test become x;
+// - conditional expressions and if statements with a literal test become
+//   the branch taken; an if with nothing to take is removed.
+// A fold is skipped when its result is not a finite number, or when a
+// discarded branch declares a var or function, since those are hoisted
+// out of it.
+static bool literal_truthy(const ASTNode* node, bool* truthy) {
+    if (!node || node->type != NODE_LITERAL) return false;
+    
+    const Literal* lit = (const Literal*)node;
+    switch (lit->literal_type) {
+        case LITERAL_STRING:
+            // By length: "\0" is a one-character string, so truthy
+            *truthy = atom_length(lit->atom) > 0;
+            return true;
+        case LITERAL_NUMBER:
+            *truthy = lit->value.number_value == lit->value.number_value && lit->value.number_value != 0;
+            return true;
+        case LITERAL_BOOLEAN:
+            *truthy = lit->value.boolean_value;
+            return true;
+        case LITERAL_NULL:
+            *truthy = false;
+            return true;
+    }
+    return false;
+}
+
+static bool number_literal(const ASTNode* node, double* value) {
+    if (!node || node->type != NODE_LITERAL || ((const Literal*)node)->literal_type != LITERAL_NUMBER) return false;
+    *value = ((const Literal*)node)->value.number_value;
+    return true;
+}
+
+// Whether an expression always evaluates to a number
+static bool expression_is_numeric(const ASTNode* node) {
+    double value;
+    if (number_literal(node, &value)) return true;
+    if (node->type == NODE_BINARY_EXPRESSION) {
+        switch (((const BinaryExpression*)node)->operator) {
+            case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            case OP_BIT_AND: case OP_BIT_OR: case OP_BIT_XOR:
+                return true;
+            default:
+                return false;
+        }
+    }
+    if (node->type == NODE_UNARY_EXPRESSION) {
+        OperatorKind op = ((const UnaryExpression*)node)->operator;
+        return op == OP_SUB || op == OP_ADD || op == OP_BIT_NOT;
+    }
+    return false;
+}
+
+// ToInt32 for integral values that a double holds exactly
+static bool to_int32(double value, int32_t* result) {
+    if (value != value || value >= 9007199254740992.0 || value <= -9007199254740992.0) return false;
+    *result = (int32_t)(uint32_t)(int64_t)value;
+    return true;
+}
+
+// Whether value is an integer within +-2^53, which converts to int64_t
+// exactly; the range is checked before converting, since converting NaN,
+// an infinity or a value out of range is undefined
+static bool is_safe_integer(double value) {
+    return value > -9007199254740992.0 && value < 9007199254740992.0 && (double)(int64_t)value == value;
+}
+
+static ASTNode* folded_number(AstArena* arena, double value, const ASTNode* at) {
+    char raw[32];
+    snprintf(raw, sizeof(raw), "%.15g", value);
+    if (strtod(raw, NULL) != value) snprintf(raw, sizeof(raw), "%.17g", value);
+    return (ASTNode*)create_literal_number(arena, value, raw, at->line, at->column);
+}
+
+static ASTNode* folded_boolean(AstArena* arena, bool value, const ASTNode* at) {
+    return (ASTNode*)create_literal_boolean(arena, value, value ? "true" : "false", at->line, at->column);
+}
+
+// Number result of op on two numbers; false if it is not foldable
+static bool fold_arithmetic(OperatorKind op, double left, double right, double* result) {
+    int32_t a, b;
+    switch (op) {
+        case OP_ADD: *result = left + right; break;
+        case OP_SUB: *result = left - right; break;
+        case OP_MUL: *result = left * right; break;
+        case OP_DIV: *result = left / right; break;
+        case OP_MOD: {
+            // Integers only; the result takes the dividend's sign, as -0 too
+            if (!is_safe_integer(left) || !is_safe_integer(right) || right == 0) return false;
+            int64_t dividend = (int64_t)left;
+            int64_t divisor = (int64_t)right;
+            *result = (double)(dividend % divisor);
+            if (*result == 0 && (left < 0 || (left == 0 && 1 / left < 0))) *result = -0.0;
             break;
         }
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+            if (!to_int32(left, &a) || !to_int32(right, &b)) return false;
+            *result = op == OP_BIT_AND ? (a & b) : op == OP_BIT_OR ? (a | b) : (a ^ b);
+            break;
+        default:
+            return false;
+    }
+    return *result == *result && *result - *result == 0;
+}
+
+// Value of == on two literals of the same type; false if they differ in type
+static bool literals_equal(const Literal* left, const Literal* right, bool* equal) {
+    if (left->literal_type != right->literal_type) return false;
+    switch (left->literal_type) {
+        case LITERAL_STRING: *equal = left->atom == right->atom; return true;
+        case LITERAL_NUMBER: *equal = left->value.number_value == right->value.number_value; return true;
+        case LITERAL_BOOLEAN: *equal = left->value.boolean_value == right->value.boolean_value; return true;
+        case LITERAL_NULL: *equal = true; return true;
+    }
+    return false;
+}
+
+static VisitResult hoisted_enter(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    if (node->type == NODE_FUNCTION_DECLARATION ||
+        (node->type == NODE_VARIABLE_DECLARATION && ((VariableDeclaration*)node)->kind == VAR_KIND_VAR)) {
+        *(bool*)data = true;
+        return VISIT_STOP;
+    }
+    uint32_t hoisted = NODE_BIT(NODE_FUNCTION_DECLARATION) | NODE_BIT(NODE_VARIABLE_DECLARATION);
+    return node_can_contain_any(node->type, hoisted) ? VISIT_CONTINUE : VISIT_SKIP_CHILDREN;
+}
+
+// Whether removing a statement would also remove a hoisted declaration
+static bool declares_hoisted(ASTNode* node) {
+    bool found = false;
+    walk_ast(node, hoisted_enter, NULL, &found);
+    return found;
+}
+
+// Take child index out of node, so freeing node leaves it alone
+static ASTNode* detach_child(ASTNode* node, size_t index) {
+    ASTNode* child = ast_child(node, index);
+    ast_set_child(node, index, NULL);
+    return child;
+}
+
+// Replace !!x by x in a test position, where only truthiness matters
+static bool simplify_test(ASTNode* node, size_t index) {
+    ASTNode* test = ast_child(node, index);
+    if (!test || test->type != NODE_UNARY_EXPRESSION || ((UnaryExpression*)test)->operator != OP_NOT) return false;
+    ASTNode* inner = (ASTNode*)((UnaryExpression*)test)->argument;
+    if (!inner || inner->type != NODE_UNARY_EXPRESSION || ((UnaryExpression*)inner)->operator != OP_NOT) return false;
+    
+    ast_set_child(node, index, detach_child(inner, 0));
+    free_ast_node(test);
+    return true;
+}
+
+// Folded form of a node whose children are already folded, or node itself.
+// *removed is set when the node should simply disappear.
+static ASTNode* fold_node(AstArena* arena, ASTNode* node, bool* removed, size_t* folds) {
+    switch (node->type) {
         case NODE_BINARY_EXPRESSION: {
             BinaryExpression* bin = (BinaryExpression*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"operator\": \"%s\",\n", bin->operator);
-            print_json_indent(indent + 1);
-            printf("\"left\": ");
-            ast_to_json((ASTNode*)bin->left, indent + 1);
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"right\": ");
-            ast_to_json((ASTNode*)bin->right, indent + 1);
-            break;
+            ASTNode* left = (ASTNode*)bin->left;
+            ASTNode* right = (ASTNode*)bin->right;
+            if (!left || !right) return node;
+            double a, b, result;
+            bool truthy;
+            
+            if (bin->operator == OP_LOGICAL_AND || bin->operator == OP_LOGICAL_OR) {
+                if (!literal_truthy(left, &truthy)) return node;
+                bool take_left = bin->operator == OP_LOGICAL_AND ? !truthy : truthy;
+                ASTNode* taken = detach_child(node, take_left ? 0 : 1);
+                free_ast_node(node);
+                (*folds)++;
+                return taken;
+            }
+            if (number_literal(left, &a) && number_literal(right, &b)) {
+                ASTNode* folded = NULL;
+                switch (bin->operator) {
+                    case OP_LT: folded = folded_boolean(arena, a < b, node); break;
+                    case OP_GT: folded = folded_boolean(arena, a > b, node); break;
+                    case OP_LE: folded = folded_boolean(arena, a <= b, node); break;
+                    case OP_GE: folded = folded_boolean(arena, a >= b, node); break;
+                    default:
+                        if (fold_arithmetic(bin->operator, a, b, &result)) folded = folded_number(arena, result, node);
+                        break;
+                }
+                if (folded) {
+                    free_ast_node(node);
+                    (*folds)++;
+                    return folded;
+                }
+            }
+            if ((bin->operator == OP_EQ || bin->operator == OP_NE) &&
+                left->type == NODE_LITERAL && right->type == NODE_LITERAL) {
+                bool equal;
+                if (!literals_equal((Literal*)left, (Literal*)right, &equal)) return node;
+                ASTNode* folded = folded_boolean(arena, bin->operator == OP_EQ ? equal : !equal, node);
+                free_ast_node(node);
+                (*folds)++;
+                return folded;
+            }
+            
+            // Identities that hold for every number, -0 and NaN included
+            size_t keep = SIZE_MAX;
+            if (number_literal(right, &b) && expression_is_numeric(left) &&
+                ((bin->operator == OP_SUB && b == 0 && 1 / b > 0) ||
+                 ((bin->operator == OP_MUL || bin->operator == OP_DIV) && b == 1))) {
+                keep = 0;
+            } else if (number_literal(left, &a) && expression_is_numeric(right) && bin->operator == OP_MUL && a == 1) {
+                keep = 1;
+            }
+            if (keep == SIZE_MAX) return node;
+            ASTNode* kept = detach_child(node, keep);
+            free_ast_node(node);
+            (*folds)++;
+            return kept;
         }
         case NODE_UNARY_EXPRESSION: {
             UnaryExpression* unary = (UnaryExpression*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"operator\": \"%s\",\n", unary->operator);
-            print_json_indent(indent + 1);
-            printf("\"argument\": ");
-            ast_to_json((ASTNode*)unary->argument, indent + 1);
-            break;
-        }
-        case NODE_VARIABLE_DECLARATION: {
-            VariableDeclaration* var_decl = (VariableDeclaration*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"kind\": \"%s\",\n", 
-                   var_decl->kind == VAR_KIND_VAR ? "var" :
-                   var_decl->kind == VAR_KIND_LET ? "let" : "const");
-            print_json_indent(indent + 1);
-            printf("\"declarations\": [\n");
-            for (size_t i = 0; i < var_decl->declarations.count; i++) {
-                if (i > 0) printf(",\n");
-                print_json_indent(indent + 2);
-                ast_to_json((ASTNode*)var_decl->declarations.items[i], indent + 2);
+            ASTNode* argument = (ASTNode*)unary->argument;
+            ASTNode* folded = NULL;
+            double value;
+            bool truthy;
+            int32_t bits;
+            if (unary->operator == OP_NOT && literal_truthy(argument, &truthy)) {
+                folded = folded_boolean(arena, !truthy, node);
+            } else if (number_literal(argument, &value)) {
+                if (unary->operator == OP_SUB) folded = folded_number(arena, -value, node);
+                else if (unary->operator == OP_ADD) folded = folded_number(arena, value, node);
+                else if (unary->operator == OP_BIT_NOT && to_int32(value, &bits)) {
+                    folded = folded_number(arena, ~bits, node);
+                }
             }
-            printf("\n");
-            print_json_indent(indent + 1);
-            printf("]");
-            break;
+            if (!folded) return node;
+            free_ast_node(node);
+            (*folds)++;
+            return folded;
         }
-        case NODE_VARIABLE_DECLARATOR: {
-            VariableDeclarator* var_declarator = (VariableDeclarator*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"id\": ");
-            ast_to_json((ASTNode*)var_declarator->id, indent + 1);
-            if (var_declarator->init) {
-                printf(",\n");
-                print_json_indent(indent + 1);
-                printf("\"init\": ");
-                ast_to_json((ASTNode*)var_declarator->init, indent + 1);
-            }
-            break;
+        case NODE_CONDITIONAL_EXPRESSION: {
+            bool truthy;
+            if (simplify_test(node, 0)) (*folds)++;
+            if (!literal_truthy((ASTNode*)((ConditionalExpression*)node)->test, &truthy)) return node;
+            ASTNode* taken = detach_child(node, truthy ? 1 : 2);
+            free_ast_node(node);
+            (*folds)++;
+            return taken;
         }
-        case NODE_FUNCTION_DECLARATION: {
-            FunctionDeclaration* func = (FunctionDeclaration*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"id\": ");
-            ast_to_json((ASTNode*)func->id, indent + 1);
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"params\": [\n");
-            for (size_t i = 0; i < func->params.count; i++) {
-                if (i > 0) printf(",\n");
-                print_json_indent(indent + 2);
-                ast_to_json((ASTNode*)func->params.items[i], indent + 2);
-            }
-            printf("\n");
-            print_json_indent(indent + 1);
-            printf("],\n");
-            print_json_indent(indent + 1);
-            printf("\"body\": ");
-            ast_to_json((ASTNode*)func->body, indent + 1);
-            if (func->return_type) {
-                printf(",\n");
-                print_json_indent(indent + 1);
-                printf("\"returnType\": \"%s\"", func->return_type);
+        case NODE_IF_STATEMENT: {
+            IfStatement* if_stmt = (IfStatement*)node;
+            bool truthy;
+            if (simplify_test(node, 0)) (*folds)++;
+            if (!literal_truthy((ASTNode*)if_stmt->test, &truthy)) return node;
+            ASTNode* discarded = (ASTNode*)(truthy ? if_stmt->alternate : if_stmt->consequent);
+            if (discarded && declares_hoisted(discarded)) return node;
+            ASTNode* taken = detach_child(node, truthy ? 1 : 2);
+            free_ast_node(node);
+            (*folds)++;
+            if (!taken) *removed = true;
+            return taken;
+        }
+        case NODE_WHILE_STATEMENT:
+        case NODE_FOR_STATEMENT:
+            if (simplify_test(node, node->type == NODE_WHILE_STATEMENT ? 0 : 1)) (*folds)++;
+            return node;
+        default:
+            return node;
+    }
+}
+
+// Statement lists whose entries may be removed outright
+static Array* statement_list(ASTNode* node) {
+    switch (node->type) {
+        case NODE_BLOCK_STATEMENT: return &((BlockStatement*)node)->body;
+        case NODE_PROGRAM: return &((Program*)node)->body;
+        case NODE_SWITCH_CASE: return &((SwitchCase*)node)->consequent;
+        default: return NULL;
+    }
+}
+
+static bool in_statement_list(const ASTNode* parent, size_t index) {
+    return parent->type == NODE_BLOCK_STATEMENT || parent->type == NODE_PROGRAM ||
+           (parent->type == NODE_SWITCH_CASE && index > 0);
+}
+
+// Drop the NULL entries left by removed children
+static void compact_array(Array* list) {
+    size_t kept = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->items[i]) list->items[kept++] = list->items[i];
+    }
+    list->count = kept;
+}
+
+typedef struct {
+    ASTNode* node;
+    size_t index;           // slot in the parent, the frame below
+    size_t next;            // next child to visit
+    size_t count;
+    bool holes;             // a statement list entry was removed
+} FoldFrame;
+
+// Fold constants throughout *root, children before parents, with an
+// explicit stack. New literals come from arena (NULL for heap; pass the
+// program's arena for an arena-built tree), and replaced heap nodes are
+// freed. *root is updated if the root itself is replaced; a Program's
+// node index is invalidated. Returns the number of folds made.
+// Folding edits nodes in place, so a tree holding hash-consed nodes, which
+// may have several parents, is left alone and 0 returned, whatever arena
+// is passed; so is any tree when arena is hash-consing.
+size_t fold_constants(AstArena* arena, ASTNode** root) {
+    if (!root || !*root) return 0;
+    if ((arena && arena->cons) || ast_has_consed_nodes(*root)) return 0;
+    
+    size_t capacity = WALK_INLINE_DEPTH;
+    size_t depth = 0;
+    FoldFrame* stack = malloc(sizeof(FoldFrame) * capacity);
+    if (!stack) return 0;
+    
+    size_t folds = 0;
+    stack[depth++] = (FoldFrame){ *root, 0, 0, ast_child_count(*root), false };
+    while (depth > 0) {
+        FoldFrame* frame = &stack[depth - 1];
+        if (frame->next < frame->count) {
+            size_t index = frame->next++;
+            ASTNode* child = ast_child(frame->node, index);
+            if (!child) continue;
+            if (depth == capacity) {
+                FoldFrame* grown = realloc(stack, sizeof(FoldFrame) * capacity * 2);
+                if (!grown) break;
+                stack = grown;
+                capacity *= 2;
             }
+            stack[depth++] = (FoldFrame){ child, index, 0, ast_child_count(child), false };
+            continue;
+        }
+        
+        FoldFrame done = stack[--depth];
+        if (done.holes) compact_array(statement_list(done.node));
+        bool removed = false;
+        ASTNode* folded = fold_node(arena, done.node, &removed, &folds);
+        if (folded == done.node && !removed) continue;
+        
+        if (depth == 0) {
+            *root = folded;
             break;
         }
-        case NODE_PARAMETER: {
-            Parameter* param = (Parameter*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"name\": ");
-            ast_to_json((ASTNode*)param->name, indent + 1);
-            if (param->param_type) {
-                printf(",\n");
-                print_json_indent(indent + 1);
-                printf("\"paramType\": \"%s\"", param->param_type);
-            }
-            if (param->default_value) {
-                printf(",\n");
-                print_json_indent(indent + 1);
-                printf("\"defaultValue\": ");
-                ast_to_json((ASTNode*)param->default_value, indent + 1);
+        FoldFrame* parent = &stack[depth - 1];
+        if (removed && !in_statement_list(parent->node, done.index)) {
+            // A statement slot that cannot be empty gets an empty block
+            folded = (ASTNode*)create_block_statement(arena, NULL, parent->node->line, parent->node->column);
+        }
+        ast_set_child(parent->node, done.index, folded);
+        if (!folded) parent->holes = true;
+    }
+    
+    free(stack);
+    if (folds > 0 && *root && (*root)->type == NODE_PROGRAM) program_invalidate_index((Program*)*root);
+    return folds;
+}
+
+// Dead code elimination
+// Removes code that cannot run or whose result is never used:
+// - statements after a return, break, continue or throw in the same
+//   statement list, except var and function declarations, which are
+//   hoisted;
+// - top-level functions that main and the top-level code never refer to;
+// - variable declarators that are never referred to and whose initializer
+//   has no side effects, and declarations left without declarators.
+// Names are matched by atom across the whole program, ignoring scopes, so
+// a name counts as used wherever it appears; that only ever keeps code.
+// Reading a name is taken to be side-effect free only when the program
+// declares it globally with var or a top-level function, which exist
+// before any code runs; any other name may be unbound (ReferenceError), or
+// a let or const read before its declaration.
+typedef struct NameUseData NameUseData;
+static void remove_counted(ASTNode* node, NameUseData* names);
+
+typedef struct {
+    NameUseData* names;     // references to take out, NULL before counting
+    size_t removed;
+} UnreachableData;
+
+static bool is_jump_statement(const ASTNode* node) {
+    return node->type == NODE_RETURN_STATEMENT || node->type == NODE_BREAK_STATEMENT ||
+           node->type == NODE_CONTINUE_STATEMENT || node->type == NODE_THROW_STATEMENT;
+}
+
+static VisitResult unreachable_enter(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    Array* list = statement_list(node);
+    if (list) {
+        size_t jump = SIZE_MAX;
+        for (size_t i = 0; i < list->count; i++) {
+            if (is_jump_statement(list->items[i])) {
+                jump = i;
+                break;
             }
-            break;
         }
-        case NODE_BLOCK_STATEMENT: {
-            BlockStatement* block = (BlockStatement*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"body\": [\n");
-            for (size_t i = 0; i < block->body.count; i++) {
-                if (i > 0) printf(",\n");
-                print_json_indent(indent + 2);
-                ast_to_json((ASTNode*)block->body.items[i], indent + 2);
+        if (jump != SIZE_MAX) {
+            UnreachableData* unreachable = data;
+            size_t kept = jump + 1;
+            for (size_t i = jump + 1; i < list->count; i++) {
+                ASTNode* statement = list->items[i];
+                if (declares_hoisted(statement)) {
+                    list->items[kept++] = statement;
+                } else {
+                    if (unreachable->names) remove_counted(statement, unreachable->names);
+                    else free_ast_node(statement);
+                    unreachable->removed++;
+                }
             }
-            printf("\n");
-            print_json_indent(indent + 1);
-            printf("]");
+            list->count = kept;
+        }
+    }
+    uint32_t lists = NODE_BIT(NODE_BLOCK_STATEMENT) | NODE_BIT(NODE_SWITCH_CASE);
+    return node_can_contain_any(node->type, lists) ? VISIT_CONTINUE : VISIT_SKIP_CHILDREN;
+}
+
+// Whether an identifier is the name a declaration introduces rather than a
+// reference to one
+static bool is_declared_name(const ASTNode* node, const ASTNode* parent) {
+    if (!parent) return false;
+    switch (parent->type) {
+        case NODE_FUNCTION_DECLARATION: return node == (ASTNode*)((const FunctionDeclaration*)parent)->id;
+        case NODE_VARIABLE_DECLARATOR: return node == (ASTNode*)((const VariableDeclarator*)parent)->id;
+        default: return false;
+    }
+}
+
+struct NameUseData {
+    size_t* uses;           // references per atom
+    bool* declared;         // atoms declared globally by var or a top-level function
+    bool removing;          // take the references of removed code back out
+};
+
+static VisitResult name_use_enter(ASTNode* node, ASTNode* parent, void* data) {
+    NameUseData* names = data;
+    if (node->type != NODE_IDENTIFIER || is_declared_name(node, parent)) return VISIT_CONTINUE;
+    
+    Atom atom = ((Identifier*)node)->atom;
+    if (names->removing) names->uses[atom]--;
+    else names->uses[atom]++;
+    return VISIT_CONTINUE;
+}
+
+// Collect the global var and function names, outside any function body
+static VisitResult global_declaration_enter(ASTNode* node, ASTNode* parent, void* data) {
+    bool* declared = data;
+    if (node->type == NODE_FUNCTION_DECLARATION) {
+        FunctionDeclaration* func = (FunctionDeclaration*)node;
+        if (parent && parent->type == NODE_PROGRAM && func->id) declared[func->id->atom] = true;
+        return VISIT_SKIP_CHILDREN;
+    }
+    if (node->type == NODE_VARIABLE_DECLARATION && ((VariableDeclaration*)node)->kind == VAR_KIND_VAR) {
+        Array* declarators = &((VariableDeclaration*)node)->declarations;
+        for (size_t i = 0; i < declarators->count; i++) {
+            VariableDeclarator* declarator = declarators->items[i];
+            if (declarator->id) declared[declarator->id->atom] = true;
+        }
+        return VISIT_SKIP_CHILDREN;
+    }
+    uint32_t declarations = NODE_BIT(NODE_FUNCTION_DECLARATION) | NODE_BIT(NODE_VARIABLE_DECLARATION);
+    return node_can_contain_any(node->type, declarations) ? VISIT_CONTINUE : VISIT_SKIP_CHILDREN;
+}
+
+// Free a subtree that is being removed, first taking back its references
+static void remove_counted(ASTNode* node, NameUseData* names) {
+    names->removing = true;
+    walk_ast(node, name_use_enter, NULL, names);
+    names->removing = false;
+    free_ast_node(node);
+}
+
+// Whether evaluating an expression can have no effect besides its value.
+// Reading a name is pure only if declared marks it.
+static bool expression_is_pure(const ASTNode* node, const bool* declared) {
+    if (!node) return true;
+    switch (node->type) {
+        case NODE_LITERAL:
+            return true;
+        case NODE_IDENTIFIER:
+            return declared[((const Identifier*)node)->atom];
+        case NODE_UNARY_EXPRESSION: {
+            OperatorKind op = ((const UnaryExpression*)node)->operator;
+            if (op == OP_INCREMENT || op == OP_DECREMENT) return false;
             break;
         }
-        case NODE_RETURN_STATEMENT: {
-            ReturnStatement* ret = (ReturnStatement*)node;
-            if (ret->argument) {
-                printf(",\n");
-                print_json_indent(indent + 1);
-                printf("\"argument\": ");
-                ast_to_json((ASTNode*)ret->argument, indent + 1);
-            }
+        case NODE_PROPERTY: {
+            // A name used as a key is not evaluated
+            const Property* prop = (const Property*)node;
+            return (!prop->key || prop->key->base.type == NODE_IDENTIFIER ||
+                    expression_is_pure((ASTNode*)prop->key, declared)) &&
+                   expression_is_pure((ASTNode*)prop->value, declared);
+        }
+        case NODE_BINARY_EXPRESSION:
+        case NODE_CONDITIONAL_EXPRESSION:
+        case NODE_ARRAY_EXPRESSION:
+        case NODE_OBJECT_EXPRESSION:
             break;
+        default:
+            // Calls, assignments and member reads (getters) may act
+            return false;
+    }
+    
+    size_t count = ast_child_count(node);
+    for (size_t i = 0; i < count; i++) {
+        if (!expression_is_pure(ast_child(node, i), declared)) return false;
+    }
+    return true;
+}
+
+// Remove unused declarators, last declaration first, so that a chain
+// like var a = 1; var b = a; goes in one pass
+static size_t remove_unused_declarators(Program* program, NameUseData* names) {
+    Array* declarations = find_nodes_by_type((ASTNode*)program, NODE_VARIABLE_DECLARATION);
+    size_t removed = 0;
+    for (size_t i = declarations->count; i-- > 0;) {
+        Array* declarators = &((VariableDeclaration*)declarations->items[i])->declarations;
+        size_t kept = declarators->count;
+        for (size_t j = declarators->count; j-- > 0;) {
+            VariableDeclarator* declarator = declarators->items[j];
+            if (declarator->id && names->uses[declarator->id->atom] == 0 &&
+                expression_is_pure((ASTNode*)declarator->init, names->declared)) {
+                remove_counted((ASTNode*)declarator, names);
+                declarators->items[j] = NULL;
+                kept--;
+                removed++;
+            }
         }
-        case NODE_PROGRAM: {
-            Program* program = (Program*)node;
-            printf(",\n");
-            print_json_indent(indent + 1);
-            printf("\"sourceType\": \"%s\",\n", 
-                   program->source_type == SOURCE_SCRIPT ? "script" : "module");
-            print_json_indent(indent + 1);
-            printf("\"body\": [\n");
-            for (size_t i = 0; i < program->body.count; i++) {
-                if (i > 0) printf(",\n");
-                print_json_indent(indent + 2);
-                ast_to_json((ASTNode*)program->body.items[i], indent + 2);
+        if (kept < declarators->count) compact_array(declarators);
+    }
+    array_free(declarations);
+    return removed;
+}
+
+static bool is_empty_declaration(const ASTNode* node) {
+    return node && node->type == NODE_VARIABLE_DECLARATION &&
+           ((const VariableDeclaration*)node)->declarations.count == 0;
+}
+
+// Drop declarations whose declarators have all been removed. A statement
+// slot that cannot be empty, like an if branch or a loop body, gets an
+// empty block instead; data is the arena to build it in.
+static VisitResult empty_declaration_enter(ASTNode* node, ASTNode* parent, void* data) {
+    (void)parent;
+    Array* list = statement_list(node);
+    if (list) {
+        size_t kept = 0;
+        for (size_t i = 0; i < list->count; i++) {
+            if (is_empty_declaration(list->items[i])) free_ast_node(list->items[i]);
+            else list->items[kept++] = list->items[i];
+        }
+        list->count = kept;
+    } else {
+        size_t count = ast_child_count(node);
+        for (size_t i = 0; i < count; i++) {
+            ASTNode* child = ast_child(node, i);
+            if (!is_empty_declaration(child)) continue;
+            
+            ASTNode* replacement = NULL;
+            if (node->type != NODE_FOR_STATEMENT || i != 0) {
+                replacement = (ASTNode*)create_block_statement(data, NULL, child->line, child->column);
             }
-            printf("\n");
-            print_json_indent(indent + 1);
-            printf("]");
-            break;
+            free_ast_node(child);
+            ast_set_child(node, i, replacement);
         }
-        default:
-            break;
     }
+    return node_can_contain(node->type, NODE_VARIABLE_DECLARATION) ? VISIT_CONTINUE : VISIT_SKIP_CHILDREN;
+}
+
+typedef struct {
+    bool* reached;          // atoms of top-level functions found reachable
+    size_t* first;          // per atom, body index of the first function so named
+    Atom* pending;          // reached function names not yet walked
+    size_t pending_count;
+} ReachData;
+
+static VisitResult reach_enter(ASTNode* node, ASTNode* parent, void* data) {
+    ReachData* reach = data;
+    if (node->type != NODE_IDENTIFIER || is_declared_name(node, parent)) return VISIT_CONTINUE;
     
-    printf("\n");
-    print_json_indent(indent);
-    printf("}");
+    Atom atom = ((Identifier*)node)->atom;
+    if (reach->first[atom] != SIZE_MAX && !reach->reached[atom]) {
+        reach->reached[atom] = true;
+        reach->pending[reach->pending_count++] = atom;
+    }
+    return VISIT_CONTINUE;
 }
 
-// AST cloning function
-ASTNode* clone_ast_node(ASTNode* node) {
-    if (!node) return NULL;
+static bool is_function_named(const ASTNode* node, Atom atom) {
+    return node->type == NODE_FUNCTION_DECLARATION && ((const FunctionDeclaration*)node)->id &&
+           ((const FunctionDeclaration*)node)->id->atom == atom;
+}
+
+// Remove the top-level functions that main and the top-level statements
+// never refer to, directly or through other functions. Does nothing when
+// the program has no main function, since then nothing says what runs.
+static size_t remove_unreachable_functions(Program* program, NameUseData* names, size_t atom_count) {
+    Array* body = &program->body;
+    Atom main_atom = intern_find_n("main", 4);
+    size_t functions = 0;
+    bool has_main = false;
+    for (size_t i = 0; i < body->count; i++) {
+        if (((ASTNode*)body->items[i])->type != NODE_FUNCTION_DECLARATION) continue;
+        functions++;
+        if (main_atom != ATOM_NONE && is_function_named(body->items[i], main_atom)) has_main = true;
+    }
+    if (!has_main) return 0;
     
-    switch (node->type) {
-        case NODE_IDENTIFIER: {
-            Identifier* orig = (Identifier*)node;
-            return (ASTNode*)create_identifier(orig->name, orig->base.line, orig->base.column);
+    // Functions with the same name are chained through next
+    ReachData reach;
+    reach.reached = calloc(atom_count, sizeof(bool));
+    reach.first = malloc(sizeof(size_t) * atom_count);
+    reach.pending = malloc(sizeof(Atom) * functions);
+    reach.pending_count = 0;
+    size_t* next = malloc(sizeof(size_t) * body->count);
+    size_t removed = 0;
+    if (!reach.reached || !reach.first || !reach.pending || !next) goto done;
+    
+    for (size_t i = 0; i < atom_count; i++) reach.first[i] = SIZE_MAX;
+    for (size_t i = body->count; i-- > 0;) {
+        FunctionDeclaration* func = body->items[i];
+        if (func->base.type != NODE_FUNCTION_DECLARATION || !func->id) continue;
+        next[i] = reach.first[func->id->atom];
+        reach.first[func->id->atom] = i;
+    }
+    reach.reached[main_atom] = true;
+    reach.pending[reach.pending_count++] = main_atom;
+    for (size_t i = 0; i < body->count; i++) {
+        if (((ASTNode*)body->items[i])->type != NODE_FUNCTION_DECLARATION) {
+            walk_ast(body->items[i], reach_enter, NULL, &reach);
         }
-        case NODE_LITERAL: {
-            Literal* orig = (Literal*)node;
-            switch (orig->literal_type) {
-                case LITERAL_STRING:
-                    return (ASTNode*)create_literal_string(orig->value.string_value, orig->raw,
-                                                          orig->base.line, orig->base.column);
-                case LITERAL_NUMBER:
-                    return (ASTNode*)create_literal_number(orig->value.number_value, orig->raw,
-                                                          orig->base.line, orig->base.column);
-                case LITERAL_BOOLEAN:
-                    return (ASTNode*)create_literal_boolean(orig->value.boolean_value, orig->raw,
-                                                           orig->base.line, orig->base.column);
-                case LITERAL_NULL:
-                    return (ASTNode*)create_literal_null(orig->raw, orig->base.line, orig->base.column);
-            }
-            break;
+    }
+    while (reach.pending_count > 0) {
+        Atom atom = reach.pending[--reach.pending_count];
+        for (size_t i = reach.first[atom]; i != SIZE_MAX; i = next[i]) {
+            walk_ast(body->items[i], reach_enter, NULL, &reach);
         }
-        case NODE_BINARY_EXPRESSION: {
-            BinaryExpression* orig = (BinaryExpression*)node;
-            Expression* left = (Expression*)clone_ast_node((ASTNode*)orig->left);
-            Expression* right = (Expression*)clone_ast_node((ASTNode*)orig->right);
-            return (ASTNode*)create_binary_expression(orig->operator, left, right,
-                                                     orig->base.line, orig->base.column);
+    }
+    
+    size_t kept = 0;
+    for (size_t i = 0; i < body->count; i++) {
+        FunctionDeclaration* func = body->items[i];
+        if (func->base.type == NODE_FUNCTION_DECLARATION && func->id && !reach.reached[func->id->atom]) {
+            remove_counted((ASTNode*)func, names);
+            removed++;
+        } else {
+            body->items[kept++] = func;
         }
-        // Add other cloning cases as needed
-        default:
-            return NULL;
     }
+    body->count = kept;
     
-    return NULL;
+done:
+    free(reach.reached);
+    free(reach.first);
+    free(reach.pending);
+    free(next);
+    return removed;
+}
+
+// Run dead code elimination to a fixed point, since removing code can
+// leave more code unused. Removed heap nodes are freed and the program's
+// node index is dropped. Returns the number of statements, functions and
+// declarators removed.
+size_t eliminate_dead_code(Program* program) {
+    if (!program) return 0;
+    
+    // The pass edits the tree under any index that was built
+    program_invalidate_index(program);
+    UnreachableData unreachable = { NULL, 0 };
+    walk_ast((ASTNode*)program, unreachable_enter, NULL, &unreachable);
+    size_t removed = unreachable.removed;
+    
+    // No atoms are created while the pass runs
+    size_t atom_count = intern_count() + 1;
+    NameUseData names;
+    names.uses = calloc(atom_count, sizeof(size_t));
+    names.declared = calloc(atom_count, sizeof(bool));
+    names.removing = false;
+    if (names.uses && names.declared) {
+        walk_ast((ASTNode*)program, name_use_enter, NULL, &names);
+        walk_ast((ASTNode*)program, global_declaration_enter, NULL, names.declared);
+        for (;;) {
+            size_t round = remove_unreachable_functions(program, &names, atom_count);
+            size_t declarators = remove_unused_declarators(program, &names);
+            if (declarators > 0) walk_ast((ASTNode*)program, empty_declaration_enter, NULL, program->arena);
+            round += declarators;
+            
+            // Code after a jump kept only for the declarations it hoisted
+            // may have lost them
+            if (round == 0) break;
+            unreachable.names = &names;
+            unreachable.removed = 0;
+            walk_ast((ASTNode*)program, unreachable_enter, NULL, &unreachable);
+            round += unreachable.removed;
+            removed += round;
+        }
+    }
+    free(names.uses);
+    free(names.declared);
+    return removed;
 }
 
 // Main function
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "intern.h"
+
+// Interned string record; atom N lives at entries[N]
+typedef struct {
+    const char* str;
+    uint32_t length;
+    uint32_t hash;
+} InternEntry;
+
+// String bytes are copied into fixed chunks so interned pointers never move
+typedef struct InternChunk {
+    struct InternChunk* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} InternChunk;
+
+#define INTERN_CHUNK_SIZE (64 * 1024)
+
+static struct {
+    InternEntry* entries;   // entries[0] is reserved for ATOM_NONE
+    uint32_t count;
+    uint32_t capacity;
+    Atom* slots;            // open-addressing hash index, ATOM_NONE when empty
+    uint32_t slot_mask;
+    InternChunk* chunks;
+} table;
+
+static uint32_t intern_hash(const char* str, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static char* intern_store(const char* str, size_t length) {
+    InternChunk* chunk = table.chunks;
+    if (!chunk || chunk->capacity - chunk->used < length + 1) {
+        size_t capacity = length + 1 > INTERN_CHUNK_SIZE ? length + 1 : INTERN_CHUNK_SIZE;
+        chunk = malloc(sizeof(InternChunk) + capacity);
+        if (!chunk) return NULL;
+        chunk->next = table.chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        table.chunks = chunk;
+    }
+
+    char* copy = chunk->data + chunk->used;
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    chunk->used += length + 1;
+    return copy;
+}
+
+static bool intern_rehash(uint32_t slot_count) {
+    Atom* slots = calloc(slot_count, sizeof(Atom));
+    if (!slots) return false;
+
+    uint32_t mask = slot_count - 1;
+    for (uint32_t atom = 1; atom < table.count; atom++) {
+        uint32_t slot = table.entries[atom].hash & mask;
+        while (slots[slot] != ATOM_NONE) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = atom;
+    }
+
+    free(table.slots);
+    table.slots = slots;
+    table.slot_mask = mask;
+    return true;
+}
+
+static bool intern_init(void) {
+    if (table.entries) return true;
+
+    table.capacity = 256;
+    table.entries = malloc(sizeof(InternEntry) * table.capacity);
+    if (!table.entries) return false;
+    table.entries[0].str = NULL;
+    table.entries[0].length = 0;
+    table.entries[0].hash = 0;
+    table.count = 1;
+
+    if (!intern_rehash(512)) {
+        free(table.entries);
+        table.entries = NULL;
+        return false;
+    }
+    return true;
+}
+
+static Atom intern_probe(const char* str, size_t length, uint32_t hash, uint32_t* slot_out) {
+    uint32_t slot = hash & table.slot_mask;
+    for (;;) {
+        Atom atom = table.slots[slot];
+        if (atom == ATOM_NONE) break;
+
+        InternEntry* entry = &table.entries[atom];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->str, str, length) == 0) {
+            return atom;
+        }
+        slot = (slot + 1) & table.slot_mask;
+    }
+    *slot_out = slot;
+    return ATOM_NONE;
+}
+
+Atom intern_find_n(const char* str, size_t length) {
+    if (!str || !table.entries) return ATOM_NONE;
+
+    uint32_t slot;
+    return intern_probe(str, length, intern_hash(str, length), &slot);
+}
+
+Atom intern_string_n(const char* str, size_t length) {
+    if (!str || length > UINT32_MAX || !intern_init()) return ATOM_NONE;
+
+    uint32_t hash = intern_hash(str, length);
+    uint32_t slot;
+    Atom atom = intern_probe(str, length, hash, &slot);
+    if (atom != ATOM_NONE) return atom;
+
+    // Keep the hash index at most half full
+    if ((table.count + 1) * 2 > table.slot_mask + 1) {
+        if (!intern_rehash((table.slot_mask + 1) * 2)) return ATOM_NONE;
+        intern_probe(str, length, hash, &slot);
+    }
+    if (table.count >= table.capacity) {
+        InternEntry* entries = realloc(table.entries, sizeof(InternEntry) * table.capacity * 2);
+        if (!entries) return ATOM_NONE;
+        table.entries = entries;
+        table.capacity *= 2;
+    }
+
+    const char* copy = intern_store(str, length);
+    if (!copy) return ATOM_NONE;
+
+    atom = table.count++;
+    table.entries[atom].str = copy;
+    table.entries[atom].length = (uint32_t)length;
+    table.entries[atom].hash = hash;
+    table.slots[slot] = atom;
+    return atom;
+}
+
+Atom intern_string(const char* str) {
+    if (!str) return ATOM_NONE;
+    return intern_string_n(str, strlen(str));
+}
+
+const char* atom_string(Atom atom) {
+    if (atom == ATOM_NONE || atom >= table.count) return NULL;
+    return table.entries[atom].str;
+}
+
+size_t atom_length(Atom atom) {
+    if (atom == ATOM_NONE || atom >= table.count) return 0;
+    return table.entries[atom].length;
+}
+
+size_t intern_count(void) {
+    return table.count > 0 ? table.count - 1 : 0;
+}
+
+void intern_reset(void) {
+    InternChunk* chunk = table.chunks;
+    while (chunk) {
+        InternChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(table.entries);
+    free(table.slots);
+    memset(&table, 0, sizeof(table));
+}
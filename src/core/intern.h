@@ -0,0 +1,31 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Global string interning table. Every distinct string is stored once and
+// named by a 32-bit atom, so comparing names is an integer compare. Interned
+// strings are NUL-terminated and stay valid until intern_reset().
+// The table is not thread-safe.
+typedef uint32_t Atom;
+
+#define ATOM_NONE 0
+
+Atom intern_string(const char* str);
+Atom intern_string_n(const char* str, size_t length);
+
+// Atom for a string if it has already been interned, ATOM_NONE otherwise
+Atom intern_find_n(const char* str, size_t length);
+
+// NULL for ATOM_NONE or an unknown atom
+const char* atom_string(Atom atom);
+size_t atom_length(Atom atom);
+
+// Number of distinct strings in the table
+size_t intern_count(void);
+
+// Release every interned string; all atoms become invalid
+void intern_reset(void);
+
+#endif
@@ -1,8 +1,27 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(LEXER_NO_SIMD)
+#include <immintrin.h>
+#define LEXER_X86_SIMD 1
+#endif
 #include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "intern.h"
+#include "operators.h"
 
 // Token type enumeration
 typedef enum {
@@ -17,12 +36,40 @@ typedef enum {
     TOKEN_EOF
 } TokenType;
 
+// Decoded value of a TOKEN_NUMBER. Integers that do not fit int64 decode
+// as floats.
+typedef enum {
+    NUMBER_NONE,            // not a number token
+    NUMBER_INT,
+    NUMBER_FLOAT
+} NumberKind;
+
+typedef struct {
+    NumberKind kind;
+    union {
+        int64_t int_value;
+        double float_value;
+    };
+} NumberValue;
+
 // Token structure
+// In zero-copy mode value is NULL and the text is the slice
+// [offset, offset + length) of the tokenized source; use token_text().
+// With interning, identifiers, keywords and strings carry an atom and take
+// their text from the intern table instead of a private copy. Operator
+// tokens carry their OperatorKind in the same slot.
 typedef struct {
     TokenType type;
+    union {
+        Atom atom;          // names, when interning
+        OperatorKind op;    // TOKEN_OPERATOR; OP_NONE for custom operators
+    };
     char* value;
     int line;
     int column;
+    size_t offset;
+    size_t length;
+    NumberValue number;
 } Token;
 
 // Tokenizer options structure
@@ -37,26 +84,165 @@ typedef struct {
     int delimiters_count;
     bool skip_unknown;
     bool case_sensitive;
+    bool zero_copy;
+    bool lazy_positions;    // leave Token.line/column at 0; see token_position()
+    bool intern_atoms;      // intern identifier, keyword and string text
 } TokenizerOptions;
 
+// Keyword lookup table: a perfect hash over the keyword set, built once
+// per tokenizer so identifier classification is a single probe.
+typedef struct {
+    int* slots;           // index into Tokenizer.keywords, -1 when empty
+    uint32_t mask;
+    uint32_t seed;
+    size_t min_length;
+    size_t max_length;
+    bool fold_case;
+} KeywordTable;
+
+// Scanning kernels used by the lexer's hot loops. Each returns the first
+// position in [pos, len) that ends the run (or len); the best available
+// implementation is chosen at runtime.
+typedef struct {
+    const char* name;
+    size_t (*skip_whitespace)(const char* input, size_t pos, size_t len);
+    size_t (*scan_identifier)(const char* input, size_t pos, size_t len);
+    size_t (*scan_digits)(const char* input, size_t pos, size_t len);
+    size_t (*find_newline)(const char* input, size_t pos, size_t len);
+    size_t (*find_star)(const char* input, size_t pos, size_t len);
+    size_t (*find_quote_or_escape)(const char* input, size_t pos, size_t len, char quote);
+} ScanKernels;
+
+// Operator/delimiter matcher: a trie-shaped DFA over every operator and
+// delimiter string. The first byte goes through a 256-entry dispatch table;
+// deeper states keep their outgoing edges as a sibling list.
+typedef struct {
+    unsigned char byte;     // byte on the edge into this state
+    TokenType accept;       // TOKEN_OPERATOR or TOKEN_DELIMITER, TOKEN_EOF if not accepting
+    int accept_index;       // index into Tokenizer.operators / Tokenizer.delimiters
+    int first_child;        // -1 when this state has no outgoing edges
+    int next_sibling;
+} PunctState;
+
+typedef struct {
+    int dispatch[256];      // first byte -> state, -1 when nothing starts with it
+    PunctState* states;
+    int state_count;
+    int state_capacity;
+} PunctDfa;
+
 // Tokenizer structure
 typedef struct {
     TokenizerOptions options;
+    const ScanKernels* kernels;
+    PunctDfa punct;
     char** keywords;
     int keywords_count;
+    KeywordTable keyword_table;
     char** operators;
     int operators_count;
+    OperatorKind* operator_kinds; // code of each entry in operators
     char** delimiters;
     int delimiters_count;
+    bool generated;         // default tables: use the generated matchers
 } Tokenizer;
 
+// Input loaded by tokenize_file(): a read-only mapping of the file, or a
+// heap buffer filled with read() for pipes and stdin. Not NUL-terminated.
+typedef struct {
+    const char* data;
+    size_t length;
+    bool mapped;
+} SourceBuffer;
+
 // Token array structure for returning multiple tokens
 typedef struct {
     Token* tokens;
     int count;
     int capacity;
+    const char* source;     // input the tokens were produced from
+    size_t source_length;
+    SourceBuffer* owned_source;  // set when the array owns its input
+    size_t* line_starts;    // offset of each line, built on demand
+    size_t line_count;
 } TokenArray;
 
+// Compact struct-of-arrays token storage: a one-byte type per token plus
+// 32-bit offset and length into the source, so walks over token types stay
+// in cache. Text is always a slice of the (not owned) source.
+// aux holds a per-token payload: the atom of an interned name, the
+// OperatorKind of an operator, or for a number token the index of its
+// decoded value in numbers.
+typedef struct {
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* lengths;
+    uint32_t* aux;
+    size_t count;
+    size_t capacity;
+    NumberValue* numbers;
+    size_t number_count;
+    size_t number_capacity;
+    const char* source;
+    size_t source_length;
+    SourceBuffer* owned_source; // set when the buffer owns its input
+    void* mapping;          // token cache file the arrays live in, if any
+    size_t mapping_length;
+    bool mapped_aux;        // aux points into the mapping too
+} TokenBuffer;
+
+// Opt-in on-disk cache of tokenized sources. Entries are keyed by an XXH64
+// hash of the content and a fingerprint of the tokenizer configuration, and
+// are laid out so a hit can be mapped and used without copying.
+typedef struct {
+    char* directory;
+    size_t hits;
+    size_t misses;
+    size_t stores;          // entries written after a miss
+} TokenCache;
+
+// Index view over selected tokens of a TokenBuffer
+typedef struct {
+    const TokenBuffer* buffer;
+    uint32_t* indices;
+    size_t count;
+} TokenView;
+
+// Token range replaced by relex_tokens(): tokens [first, first + removed)
+// of the old array became [first, first + inserted)
+typedef struct {
+    int first;
+    int removed;
+    int inserted;
+} TokenChange;
+
+// Streaming lexer: a cursor over the input that produces one token per
+// call, following the same rules as tokenize()
+typedef struct {
+    Tokenizer* tokenizer;
+    const char* input;
+    size_t length;
+    size_t pos;
+    int line;
+    size_t line_start;      // offset of the first byte of the current line
+    bool copy_text;         // tokens own a copy of their text
+    bool track_positions;   // fill in Token.line/column
+    bool intern_atoms;
+    bool finished;          // EOF token has been scanned
+    Token* lookahead;       // ring buffer of tokens scanned by lexer_peek()
+    int lookahead_start;
+    int lookahead_count;
+    int lookahead_capacity;
+} Lexer;
+
+// Keyword and operator matchers specialized for the default sets, written
+// by `lexer --gen-lexer` (regenerate after changing default_keywords,
+// default_operators or default_delimiters; build with -DLEXER_NO_GENERATED
+// when the file is missing or broken)
+#ifndef LEXER_NO_GENERATED
+#include "lexer_default.inc"
+#endif
+
 // Utility functions
 char* string_duplicate(const char* str) {
     if (!str) return NULL;
@@ -80,7 +266,127 @@ char* string_to_lower(const char* str) {
     return lower;
 }
 
+static inline unsigned char ascii_lower(unsigned char ch) {
+    return (ch >= 'A' && ch <= 'Z') ? (unsigned char)(ch + ('a' - 'A')) : ch;
+}
+
+static uint32_t keyword_hash(const char* word, size_t len, uint32_t seed, bool fold_case) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)word[i];
+        hash ^= fold_case ? ascii_lower(ch) : ch;
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 15;
+    return hash;
+}
+
+static bool keyword_equals(const char* keyword, const char* word, size_t len, bool fold_case) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char a = (unsigned char)keyword[i];
+        unsigned char b = (unsigned char)word[i];
+        if (a == '\0') return false;
+        if (fold_case ? ascii_lower(a) != ascii_lower(b) : a != b) return false;
+    }
+    return keyword[len] == '\0';
+}
+
+// Try to place every keyword in its own slot for the given seed and size.
+// Keywords that are equal (e.g. "If" and "if" without case sensitivity)
+// are allowed to share a slot.
+static bool keyword_table_try_build(KeywordTable* table, char** keywords, int count,
+                                    uint32_t size, uint32_t seed) {
+    for (uint32_t i = 0; i < size; i++) {
+        table->slots[i] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(keywords[i]);
+        uint32_t slot = keyword_hash(keywords[i], len, seed, table->fold_case) & (size - 1);
+        int existing = table->slots[slot];
+        if (existing >= 0) {
+            if (!keyword_equals(keywords[existing], keywords[i], len, table->fold_case)) {
+                return false;
+            }
+            continue;
+        }
+        table->slots[slot] = i;
+    }
+    table->mask = size - 1;
+    table->seed = seed;
+    return true;
+}
+
+static bool keyword_table_build(KeywordTable* table, char** keywords, int count, bool fold_case) {
+    table->slots = NULL;
+    table->mask = 0;
+    table->seed = 0;
+    table->min_length = SIZE_MAX;
+    table->max_length = 0;
+    table->fold_case = fold_case;
+    
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(keywords[i]);
+        if (len < table->min_length) table->min_length = len;
+        if (len > table->max_length) table->max_length = len;
+    }
+    
+    uint32_t size = 8;
+    while (size < (uint32_t)count * 2) {
+        size <<= 1;
+    }
+    
+    // Search for a collision-free seed, growing the table if none is found
+    for (; size <= (1u << 20); size <<= 1) {
+        int* slots = realloc(table->slots, sizeof(int) * size);
+        if (!slots) break;
+        table->slots = slots;
+        for (uint32_t seed = 0; seed < 256; seed++) {
+            if (keyword_table_try_build(table, keywords, count, size, seed)) {
+                return true;
+            }
+        }
+    }
+    
+    free(table->slots);
+    table->slots = NULL;
+    return false;
+}
+
+static void keyword_table_free(KeywordTable* table) {
+    free(table->slots);
+    table->slots = NULL;
+}
+
+bool is_keyword_n(Tokenizer* tokenizer, const char* word, size_t len) {
+    KeywordTable* table = &tokenizer->keyword_table;
+#ifdef GENERATED_LEXER_FINGERPRINT
+    if (tokenizer->generated) {
+        return generated_keyword_index(word, len, table->fold_case) >= 0;
+    }
+#endif
+    if (!table->slots) {
+        // Table could not be built; fall back to a scan that still avoids allocation
+        for (int i = 0; i < tokenizer->keywords_count; i++) {
+            if (keyword_equals(tokenizer->keywords[i], word, len, table->fold_case)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (len < table->min_length || len > table->max_length) {
+        return false;
+    }
+    uint32_t slot = keyword_hash(word, len, table->seed, table->fold_case) & table->mask;
+    int index = table->slots[slot];
+    return index >= 0 && keyword_equals(tokenizer->keywords[index], word, len, table->fold_case);
+}
+
 bool is_keyword(Tokenizer* tokenizer, const char* word) {
+    return is_keyword_n(tokenizer, word, strlen(word));
+}
+
+// Reference implementation kept for benchmarking the keyword table
+static bool is_keyword_linear(Tokenizer* tokenizer, const char* word) {
     for (int i = 0; i < tokenizer->keywords_count; i++) {
         if (tokenizer->options.case_sensitive) {
             if (strcmp(tokenizer->keywords[i], word) == 0) {
@@ -98,6 +404,434 @@ bool is_keyword(Tokenizer* tokenizer, const char* word) {
     return false;
 }
 
+// Character classes (ASCII only, independent of the C locale)
+static inline bool char_is_space(unsigned char ch) {
+    return ch == ' ' || (unsigned char)(ch - '\t') <= '\r' - '\t';
+}
+
+static inline bool char_is_digit(unsigned char ch) {
+    return (unsigned char)(ch - '0') <= 9;
+}
+
+static inline bool char_is_ident_start(unsigned char ch) {
+    return (unsigned char)((ch | 0x20) - 'a') <= 'z' - 'a' || ch == '_';
+}
+
+static inline bool char_is_ident(unsigned char ch) {
+    return char_is_ident_start(ch) || char_is_digit(ch);
+}
+
+// Scalar kernels
+static size_t scalar_skip_whitespace(const char* input, size_t pos, size_t len) {
+    while (pos < len && char_is_space((unsigned char)input[pos])) pos++;
+    return pos;
+}
+
+static size_t scalar_scan_identifier(const char* input, size_t pos, size_t len) {
+    while (pos < len && char_is_ident((unsigned char)input[pos])) pos++;
+    return pos;
+}
+
+static size_t scalar_scan_digits(const char* input, size_t pos, size_t len) {
+    while (pos < len && char_is_digit((unsigned char)input[pos])) pos++;
+    return pos;
+}
+
+static size_t scalar_find_newline(const char* input, size_t pos, size_t len) {
+    if (pos >= len) return len;
+    const char* nl = memchr(input + pos, '\n', len - pos);
+    return nl ? (size_t)(nl - input) : len;
+}
+
+static size_t scalar_find_star(const char* input, size_t pos, size_t len) {
+    if (pos >= len) return len;
+    const char* star = memchr(input + pos, '*', len - pos);
+    return star ? (size_t)(star - input) : len;
+}
+
+static size_t scalar_find_quote_or_escape(const char* input, size_t pos, size_t len, char quote) {
+    while (pos < len && input[pos] != quote && input[pos] != '\\') pos++;
+    return pos;
+}
+
+static const ScanKernels scalar_kernels = {
+    "scalar",
+    scalar_skip_whitespace,
+    scalar_scan_identifier,
+    scalar_scan_digits,
+    scalar_find_newline,
+    scalar_find_star,
+    scalar_find_quote_or_escape
+};
+
+#ifdef LEXER_X86_SIMD
+// SSE2 kernels: classify 16 bytes at a time and use the movemask of the
+// bytes that end the run. Unsigned range checks use max(x, hi) == hi.
+static inline __m128i sse2_in_range(__m128i v, char lo, char hi) {
+    __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    __m128i limit = _mm_set1_epi8((char)(hi - lo));
+    return _mm_cmpeq_epi8(_mm_max_epu8(shifted, limit), limit);
+}
+
+static inline __m128i sse2_is_space(__m128i v) {
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), sse2_in_range(v, '\t', '\r'));
+}
+
+static inline __m128i sse2_is_ident(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(_mm_or_si128(sse2_in_range(lower, 'a', 'z'), sse2_in_range(v, '0', '9')),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+#define SSE2_SCAN_WHILE(test, input, pos, len)                                      \
+    while ((pos) + 16 <= (len)) {                                                   \
+        __m128i v = _mm_loadu_si128((const __m128i*)((input) + (pos)));             \
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(test) & 0xFFFFu;               \
+        if (mask) return (pos) + (size_t)__builtin_ctz(mask);                       \
+        (pos) += 16;                                                                \
+    }
+
+#define SSE2_SCAN_UNTIL(test, input, pos, len)                                      \
+    while ((pos) + 16 <= (len)) {                                                   \
+        __m128i v = _mm_loadu_si128((const __m128i*)((input) + (pos)));             \
+        unsigned mask = (unsigned)_mm_movemask_epi8(test);                          \
+        if (mask) return (pos) + (size_t)__builtin_ctz(mask);                       \
+        (pos) += 16;                                                                \
+    }
+
+static size_t sse2_skip_whitespace(const char* input, size_t pos, size_t len) {
+    SSE2_SCAN_WHILE(sse2_is_space(v), input, pos, len);
+    return scalar_skip_whitespace(input, pos, len);
+}
+
+static size_t sse2_scan_identifier(const char* input, size_t pos, size_t len) {
+    SSE2_SCAN_WHILE(sse2_is_ident(v), input, pos, len);
+    return scalar_scan_identifier(input, pos, len);
+}
+
+static size_t sse2_scan_digits(const char* input, size_t pos, size_t len) {
+    SSE2_SCAN_WHILE(sse2_in_range(v, '0', '9'), input, pos, len);
+    return scalar_scan_digits(input, pos, len);
+}
+
+static size_t sse2_find_newline(const char* input, size_t pos, size_t len) {
+    SSE2_SCAN_UNTIL(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), input, pos, len);
+    return scalar_find_newline(input, pos, len);
+}
+
+static size_t sse2_find_star(const char* input, size_t pos, size_t len) {
+    SSE2_SCAN_UNTIL(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')), input, pos, len);
+    return scalar_find_star(input, pos, len);
+}
+
+static size_t sse2_find_quote_or_escape(const char* input, size_t pos, size_t len, char quote) {
+    SSE2_SCAN_UNTIL(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(quote)),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))), input, pos, len);
+    return scalar_find_quote_or_escape(input, pos, len, quote);
+}
+
+static const ScanKernels sse2_kernels = {
+    "sse2",
+    sse2_skip_whitespace,
+    sse2_scan_identifier,
+    sse2_scan_digits,
+    sse2_find_newline,
+    sse2_find_star,
+    sse2_find_quote_or_escape
+};
+
+// AVX2 kernels: same classification over 32 bytes, compiled for AVX2 only
+// and selected when the CPU reports support for it
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i avx2_in_range(__m256i v, char lo, char hi) {
+    __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    __m256i limit = _mm256_set1_epi8((char)(hi - lo));
+    return _mm256_cmpeq_epi8(_mm256_max_epu8(shifted, limit), limit);
+}
+
+AVX2_TARGET static inline __m256i avx2_is_space(__m256i v) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), avx2_in_range(v, '\t', '\r'));
+}
+
+AVX2_TARGET static inline __m256i avx2_is_ident(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(_mm256_or_si256(avx2_in_range(lower, 'a', 'z'), avx2_in_range(v, '0', '9')),
+                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+#define AVX2_SCAN_WHILE(test, input, pos, len)                                      \
+    while ((pos) + 32 <= (len)) {                                                   \
+        __m256i v = _mm256_loadu_si256((const __m256i*)((input) + (pos)));          \
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(test);                      \
+        if (mask) return (pos) + (size_t)__builtin_ctz(mask);                       \
+        (pos) += 32;                                                                \
+    }
+
+#define AVX2_SCAN_UNTIL(test, input, pos, len)                                      \
+    while ((pos) + 32 <= (len)) {                                                   \
+        __m256i v = _mm256_loadu_si256((const __m256i*)((input) + (pos)));          \
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(test);                       \
+        if (mask) return (pos) + (size_t)__builtin_ctz(mask);                       \
+        (pos) += 32;                                                                \
+    }
+
+AVX2_TARGET static size_t avx2_skip_whitespace(const char* input, size_t pos, size_t len) {
+    AVX2_SCAN_WHILE(avx2_is_space(v), input, pos, len);
+    return sse2_skip_whitespace(input, pos, len);
+}
+
+AVX2_TARGET static size_t avx2_scan_identifier(const char* input, size_t pos, size_t len) {
+    AVX2_SCAN_WHILE(avx2_is_ident(v), input, pos, len);
+    return sse2_scan_identifier(input, pos, len);
+}
+
+AVX2_TARGET static size_t avx2_scan_digits(const char* input, size_t pos, size_t len) {
+    AVX2_SCAN_WHILE(avx2_in_range(v, '0', '9'), input, pos, len);
+    return sse2_scan_digits(input, pos, len);
+}
+
+AVX2_TARGET static size_t avx2_find_newline(const char* input, size_t pos, size_t len) {
+    AVX2_SCAN_UNTIL(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), input, pos, len);
+    return sse2_find_newline(input, pos, len);
+}
+
+AVX2_TARGET static size_t avx2_find_star(const char* input, size_t pos, size_t len) {
+    AVX2_SCAN_UNTIL(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')), input, pos, len);
+    return sse2_find_star(input, pos, len);
+}
+
+AVX2_TARGET static size_t avx2_find_quote_or_escape(const char* input, size_t pos, size_t len, char quote) {
+    AVX2_SCAN_UNTIL(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(quote)),
+                                    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))), input, pos, len);
+    return sse2_find_quote_or_escape(input, pos, len, quote);
+}
+
+static const ScanKernels avx2_kernels = {
+    "avx2",
+    avx2_skip_whitespace,
+    avx2_scan_identifier,
+    avx2_scan_digits,
+    avx2_find_newline,
+    avx2_find_star,
+    avx2_find_quote_or_escape
+};
+#endif
+
+// Pick the widest kernels the CPU supports
+const ScanKernels* select_scan_kernels() {
+#ifdef LEXER_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &avx2_kernels;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &sse2_kernels;
+    }
+#endif
+    return &scalar_kernels;
+}
+
+// Numeric literals
+// Forms: 123, 1_000, 0x1F, 0b1010, 1.5, 2.5e-3, 1e9. Underscores may only
+// sit between two digits and a '.' or exponent is only part of the number
+// when a digit follows it, so "1.2.3" is 1.2 . 3 and "1.foo" is 1 . foo.
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int hex_digit_value(unsigned char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    ch |= 0x20;
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+// End of a run of digits of the given base that may contain single
+// underscores between digits
+static size_t scan_digit_run(const ScanKernels* scan, const char* input, size_t pos, size_t len,
+                             int base) {
+    for (;;) {
+        if (base == 10) {
+            pos = scan->scan_digits(input, pos, len);
+        } else {
+            while (pos < len && hex_digit_value((unsigned char)input[pos]) >= 0 &&
+                   hex_digit_value((unsigned char)input[pos]) < base) {
+                pos++;
+            }
+        }
+        if (pos + 1 < len && input[pos] == '_') {
+            int next = hex_digit_value((unsigned char)input[pos + 1]);
+            if (next >= 0 && next < base) {
+                pos++;
+                continue;
+            }
+        }
+        return pos;
+    }
+}
+
+// Correctly rounded conversion of a decimal literal through strtod, with
+// the digit separators removed
+static double decode_decimal_slow(const char* text, size_t length) {
+    char stack[128];
+    char* digits = length < sizeof(stack) ? stack : malloc(length + 1);
+    if (!digits) return NAN;
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] != '_') digits[n++] = text[i];
+    }
+    digits[n] = '\0';
+    double value = strtod(digits, NULL);
+    if (digits != stack) free(digits);
+    return value;
+}
+
+// Decode a decimal literal scanned by scan_number(). Integers that fit take
+// the int64 path. Floats with at most 19 significant digits whose mantissa
+// and power of ten are both exactly representable are computed with one
+// correctly rounded multiply or divide (Clinger's fast path); anything else
+// goes through strtod.
+static NumberValue decode_decimal(const char* text, size_t length) {
+    NumberValue number;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int64_t exponent = 0;
+    bool truncated = false;
+    bool fraction = false;
+    size_t i = 0;
+    
+    for (; i < length; i++) {
+        unsigned char ch = (unsigned char)text[i];
+        if (ch == '_') continue;
+        if (ch == '.') {
+            fraction = true;
+            continue;
+        }
+        if (!char_is_digit(ch)) break;
+        
+        if (mantissa == 0 && ch == '0') {
+            if (fraction) exponent--;
+        } else if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(ch - '0');
+            digits++;
+            if (fraction) exponent--;
+        } else {
+            truncated = true;
+            if (!fraction) exponent++;
+        }
+    }
+    
+    bool has_exponent = i < length;
+    if (has_exponent) {
+        i++; // 'e' or 'E'
+        bool negative = false;
+        if (text[i] == '+' || text[i] == '-') {
+            negative = text[i] == '-';
+            i++;
+        }
+        int64_t value = 0;
+        for (; i < length; i++) {
+            if (text[i] == '_') continue;
+            if (value < 100000) value = value * 10 + (text[i] - '0');
+        }
+        exponent += negative ? -value : value;
+    }
+    
+    if (!fraction && !has_exponent && !truncated && mantissa <= (uint64_t)INT64_MAX) {
+        number.kind = NUMBER_INT;
+        number.int_value = (int64_t)mantissa;
+        return number;
+    }
+    
+    number.kind = NUMBER_FLOAT;
+    if (!truncated && mantissa <= (UINT64_C(1) << 53)) {
+        double value = (double)mantissa;
+        if (mantissa == 0) {
+            number.float_value = 0.0;
+            return number;
+        }
+        if (exponent >= -22 && exponent <= 22) {
+            number.float_value = exponent < 0 ? value / exact_powers_of_ten[-exponent]
+                                               : value * exact_powers_of_ten[exponent];
+            return number;
+        }
+        // 123e30 = 123000000e24: shift digits into the mantissa while it
+        // stays exact
+        if (exponent > 22 && exponent <= 22 + 15) {
+            uint64_t shifted = mantissa;
+            int64_t e = exponent;
+            while (e > 22 && shifted <= (UINT64_C(1) << 53) / 10) {
+                shifted *= 10;
+                e--;
+            }
+            if (e == 22) {
+                number.float_value = (double)shifted * exact_powers_of_ten[22];
+                return number;
+            }
+        }
+    }
+    number.float_value = decode_decimal_slow(text, length);
+    return number;
+}
+
+// Scan the numeric literal at input[pos] (a digit) and decode its value.
+// Returns the end of the literal.
+static size_t scan_number(const ScanKernels* scan, const char* input, size_t pos, size_t len,
+                          NumberValue* out) {
+    size_t start = pos;
+    
+    // Hexadecimal and binary integers
+    if (input[pos] == '0' && pos + 2 < len) {
+        unsigned char prefix = (unsigned char)(input[pos + 1] | 0x20);
+        int base = prefix == 'x' ? 16 : prefix == 'b' ? 2 : 0;
+        int first = hex_digit_value((unsigned char)input[pos + 2]);
+        if (base && first >= 0 && first < base) {
+            size_t end = scan_digit_run(scan, input, pos + 2, len, base);
+            uint64_t value = 0;
+            double approx = 0.0;
+            bool overflow = false;
+            for (size_t i = pos + 2; i < end; i++) {
+                if (input[i] == '_') continue;
+                int digit = hex_digit_value((unsigned char)input[i]);
+                if (!overflow && value > ((uint64_t)INT64_MAX - (uint64_t)digit) / (uint64_t)base) {
+                    overflow = true;
+                    approx = (double)value;
+                }
+                if (overflow) {
+                    approx = approx * base + digit;
+                } else {
+                    value = value * (uint64_t)base + (uint64_t)digit;
+                }
+            }
+            if (overflow) {
+                out->kind = NUMBER_FLOAT;
+                out->float_value = approx;
+            } else {
+                out->kind = NUMBER_INT;
+                out->int_value = (int64_t)value;
+            }
+            return end;
+        }
+    }
+    
+    pos = scan_digit_run(scan, input, pos, len, 10);
+    if (pos + 1 < len && input[pos] == '.' && char_is_digit((unsigned char)input[pos + 1])) {
+        pos = scan_digit_run(scan, input, pos + 1, len, 10);
+    }
+    if (pos + 1 < len && (input[pos] | 0x20) == 'e') {
+        size_t digits = pos + 1;
+        if (digits + 1 < len && (input[digits] == '+' || input[digits] == '-')) digits++;
+        if (digits < len && char_is_digit((unsigned char)input[digits])) {
+            pos = scan_digit_run(scan, input, digits, len, 10);
+        }
+    }
+    
+    *out = decode_decimal(input + start, pos - start);
+    return pos;
+}
+
 // Token creation
 Token create_token(TokenType type, const char* value, int line, int column) {
     Token token;
@@ -105,9 +839,59 @@ Token create_token(TokenType type, const char* value, int line, int column) {
     token.value = string_duplicate(value);
     token.line = line;
     token.column = column;
+    token.offset = 0;
+    token.length = value ? strlen(value) : 0;
+    token.atom = ATOM_NONE;
+    token.number.kind = NUMBER_NONE;
+    return token;
+}
+
+// Create a token for input[offset, offset + length). Copies the text unless
+// the tokenizer runs in zero-copy mode.
+Token create_token_slice(TokenType type, const char* input, size_t offset, size_t length,
+                         int line, int column, bool copy) {
+    Token token;
+    token.type = type;
+    token.value = NULL;
+    if (copy) {
+        token.value = malloc(length + 1);
+        if (token.value) {
+            memcpy(token.value, input + offset, length);
+            token.value[length] = '\0';
+        }
+    }
+    token.line = line;
+    token.column = column;
+    token.offset = offset;
+    token.length = length;
+    token.atom = ATOM_NONE;
+    token.number.kind = NUMBER_NONE;
     return token;
 }
 
+// Text of a token. Returns a pointer into source for zero-copy tokens, so
+// the result is not NUL-terminated in that case; use the returned length.
+const char* token_text(const Token* token, const char* source, size_t* length) {
+    if (!token) return NULL;
+    if (length) *length = token->length;
+    if (token->value) return token->value;
+    if (token->type != TOKEN_OPERATOR && token->atom != ATOM_NONE) return atom_string(token->atom);
+    return source ? source + token->offset : NULL;
+}
+
+// Heap-allocated, NUL-terminated copy of a token's text
+char* token_text_copy(const Token* token, const char* source) {
+    size_t length;
+    const char* text = token_text(token, source, &length);
+    if (!text) return NULL;
+    char* copy = malloc(length + 1);
+    if (copy) {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
 void free_token(Token* token) {
     if (token && token->value) {
         free(token->value);
@@ -116,27 +900,69 @@ void free_token(Token* token) {
 }
 
 // TokenArray functions
-TokenArray* create_token_array() {
+// Rough upper estimate of the token count for an input, used to size
+// token storage up front
+size_t estimate_token_count(size_t input_length) {
+    return input_length / 4 + 16;
+}
+
+// Starting capacity of a TokenArray for an input. Token structs are large,
+// so the estimate, which is sized for the compact TokenBuffer, is capped
+// and bigger inputs grow the array by doubling.
+#define TOKEN_ARRAY_INITIAL_MAX 4096
+
+static int token_array_initial_capacity(size_t input_length) {
+    size_t estimate = estimate_token_count(input_length);
+    return estimate < TOKEN_ARRAY_INITIAL_MAX ? (int)estimate : TOKEN_ARRAY_INITIAL_MAX;
+}
+
+TokenArray* create_token_array_with_capacity(int capacity) {
+    if (capacity < 1) capacity = 1;
+    
     TokenArray* arr = malloc(sizeof(TokenArray));
     if (arr) {
-        arr->tokens = malloc(sizeof(Token) * 100);
+        arr->tokens = malloc(sizeof(Token) * capacity);
+        if (!arr->tokens) {
+            free(arr);
+            return NULL;
+        }
         arr->count = 0;
-        arr->capacity = 100;
+        arr->capacity = capacity;
+        arr->source = NULL;
+        arr->source_length = 0;
+        arr->owned_source = NULL;
+        arr->line_starts = NULL;
+        arr->line_count = 0;
     }
     return arr;
 }
 
-void add_token(TokenArray* arr, Token token) {
-    if (!arr) return;
+TokenArray* create_token_array() {
+    return create_token_array_with_capacity(100);
+}
+
+// Append a token; on allocation failure the token is released and false
+// is returned
+bool add_token(TokenArray* arr, Token token) {
+    if (!arr) return false;
     
     if (arr->count >= arr->capacity) {
-        arr->capacity *= 2;
-        arr->tokens = realloc(arr->tokens, sizeof(Token) * arr->capacity);
+        int capacity = arr->capacity * 2;
+        Token* tokens = realloc(arr->tokens, sizeof(Token) * capacity);
+        if (!tokens) {
+            free_token(&token);
+            return false;
+        }
+        arr->tokens = tokens;
+        arr->capacity = capacity;
     }
     
     arr->tokens[arr->count++] = token;
+    return true;
 }
 
+void source_buffer_close(SourceBuffer* buffer);
+
 void free_token_array(TokenArray* arr) {
     if (!arr) return;
     
@@ -144,6 +970,8 @@ void free_token_array(TokenArray* arr) {
         free_token(&arr->tokens[i]);
     }
     free(arr->tokens);
+    free(arr->line_starts);
+    source_buffer_close(arr->owned_source);
     free(arr);
 }
 
@@ -163,35 +991,160 @@ static const char* default_delimiters[] = {
     "(", ")", "{", "}", "[", "]", ",", ";", ".", "->"
 };
 
-// Comparison function for sorting operators by length (descending)
-int compare_operators(const void* a, const void* b) {
-    const char* str_a = *(const char**)a;
-    const char* str_b = *(const char**)b;
-    return strlen(str_b) - strlen(str_a);
+// Fingerprint of the default sets, so stale generated matchers are ignored
+static uint64_t default_tables_fingerprint(void) {
+    const char** sets[] = { default_keywords, default_operators, default_delimiters };
+    size_t counts[] = {
+        sizeof(default_keywords) / sizeof(default_keywords[0]),
+        sizeof(default_operators) / sizeof(default_operators[0]),
+        sizeof(default_delimiters) / sizeof(default_delimiters[0])
+    };
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (int set = 0; set < 3; set++) {
+        for (size_t i = 0; i < counts[set]; i++) {
+            // Each string including its NUL, then a separator per set
+            for (const char* c = sets[set][i]; ; c++) {
+                hash = (hash ^ (unsigned char)*c) * UINT64_C(1099511628211);
+                if (!*c) break;
+            }
+        }
+        hash = (hash ^ 0xff) * UINT64_C(1099511628211);
+    }
+    return hash;
 }
 
-// Initialize tokenizer
-Tokenizer* create_tokenizer(TokenizerOptions* options) {
-    Tokenizer* tokenizer = malloc(sizeof(Tokenizer));
-    if (!tokenizer) return NULL;
+// Operator/delimiter DFA
+static int punct_add_state(PunctDfa* dfa, unsigned char byte) {
+    if (dfa->state_count >= dfa->state_capacity) {
+        int capacity = dfa->state_capacity ? dfa->state_capacity * 2 : 32;
+        PunctState* states = realloc(dfa->states, sizeof(PunctState) * capacity);
+        if (!states) return -1;
+        dfa->states = states;
+        dfa->state_capacity = capacity;
+    }
+    PunctState* state = &dfa->states[dfa->state_count];
+    state->byte = byte;
+    state->accept = TOKEN_EOF;
+    state->accept_index = -1;
+    state->first_child = -1;
+    state->next_sibling = -1;
+    return dfa->state_count++;
+}
+
+static bool punct_insert(PunctDfa* dfa, const char* text, TokenType type, int index) {
+    size_t len = strlen(text);
+    if (len == 0) return true;
     
-    // Set default options
-    if (options) {
-        tokenizer->options = *options;
-    } else {
-        tokenizer->options.include_whitespace = false;
-        tokenizer->options.include_comments = false;
-        tokenizer->options.skip_unknown = true;
-        tokenizer->options.case_sensitive = true;
-        tokenizer->options.keywords = NULL;
-        tokenizer->options.operators = NULL;
-        tokenizer->options.delimiters = NULL;
+    unsigned char first = (unsigned char)text[0];
+    int state = dfa->dispatch[first];
+    if (state < 0) {
+        state = punct_add_state(dfa, first);
+        if (state < 0) return false;
+        dfa->dispatch[first] = state;
     }
     
-    // Setup keywords
-    if (tokenizer->options.keywords && tokenizer->options.keywords_count > 0) {
-        tokenizer->keywords_count = tokenizer->options.keywords_count;
-        tokenizer->keywords = malloc(sizeof(char*) * tokenizer->keywords_count);
+    for (size_t i = 1; i < len; i++) {
+        unsigned char byte = (unsigned char)text[i];
+        int child = dfa->states[state].first_child;
+        while (child >= 0 && dfa->states[child].byte != byte) {
+            child = dfa->states[child].next_sibling;
+        }
+        if (child < 0) {
+            child = punct_add_state(dfa, byte);
+            if (child < 0) return false;
+            dfa->states[child].next_sibling = dfa->states[state].first_child;
+            dfa->states[state].first_child = child;
+        }
+        state = child;
+    }
+    
+    dfa->states[state].accept = type;
+    dfa->states[state].accept_index = index;
+    return true;
+}
+
+// Delimiters go in first so an operator spelled the same way takes
+// precedence, as it did when operators were tried before delimiters
+static bool punct_dfa_build(PunctDfa* dfa, char** operators, int operators_count,
+                            char** delimiters, int delimiters_count) {
+    for (int i = 0; i < 256; i++) {
+        dfa->dispatch[i] = -1;
+    }
+    dfa->states = NULL;
+    dfa->state_count = 0;
+    dfa->state_capacity = 0;
+    
+    for (int i = 0; i < delimiters_count; i++) {
+        if (!punct_insert(dfa, delimiters[i], TOKEN_DELIMITER, i)) return false;
+    }
+    for (int i = 0; i < operators_count; i++) {
+        if (!punct_insert(dfa, operators[i], TOKEN_OPERATOR, i)) return false;
+    }
+    return true;
+}
+
+static void punct_dfa_free(PunctDfa* dfa) {
+    free(dfa->states);
+    dfa->states = NULL;
+    dfa->state_count = 0;
+    dfa->state_capacity = 0;
+}
+
+// Longest operator or delimiter starting at input[pos]. Returns its length
+// (0 when none matches) and the type and index of the match.
+static size_t punct_match(const PunctDfa* dfa, const char* input, size_t pos, size_t len,
+                          TokenType* type, int* index) {
+    int state = dfa->dispatch[(unsigned char)input[pos]];
+    size_t matched = 0;
+    const PunctState* accepted = NULL;
+    
+    for (size_t i = pos + 1; state >= 0; i++) {
+        const PunctState* current = &dfa->states[state];
+        if (current->accept != TOKEN_EOF) {
+            matched = i - pos;
+            accepted = current;
+        }
+        if (i >= len) break;
+        
+        unsigned char byte = (unsigned char)input[i];
+        state = current->first_child;
+        while (state >= 0 && dfa->states[state].byte != byte) {
+            state = dfa->states[state].next_sibling;
+        }
+    }
+    
+    if (accepted) {
+        *type = accepted->accept;
+        *index = accepted->accept_index;
+    }
+    return matched;
+}
+
+// Initialize tokenizer
+Tokenizer* create_tokenizer(TokenizerOptions* options) {
+    Tokenizer* tokenizer = malloc(sizeof(Tokenizer));
+    if (!tokenizer) return NULL;
+    
+    tokenizer->kernels = select_scan_kernels();
+    
+    // Set default options
+    if (options) {
+        tokenizer->options = *options;
+    } else {
+        memset(&tokenizer->options, 0, sizeof(tokenizer->options));
+        tokenizer->options.include_whitespace = false;
+        tokenizer->options.include_comments = false;
+        tokenizer->options.skip_unknown = true;
+        tokenizer->options.case_sensitive = true;
+        tokenizer->options.keywords = NULL;
+        tokenizer->options.operators = NULL;
+        tokenizer->options.delimiters = NULL;
+    }
+    
+    // Setup keywords
+    if (tokenizer->options.keywords && tokenizer->options.keywords_count > 0) {
+        tokenizer->keywords_count = tokenizer->options.keywords_count;
+        tokenizer->keywords = malloc(sizeof(char*) * tokenizer->keywords_count);
         for (int i = 0; i < tokenizer->keywords_count; i++) {
             tokenizer->keywords[i] = string_duplicate(tokenizer->options.keywords[i]);
         }
@@ -203,6 +1156,9 @@ Tokenizer* create_tokenizer(TokenizerOptions* options) {
         }
     }
     
+    keyword_table_build(&tokenizer->keyword_table, tokenizer->keywords,
+                        tokenizer->keywords_count, !tokenizer->options.case_sensitive);
+    
     // Setup operators
     if (tokenizer->options.operators && tokenizer->options.operators_count > 0) {
         tokenizer->operators_count = tokenizer->options.operators_count;
@@ -217,9 +1173,10 @@ Tokenizer* create_tokenizer(TokenizerOptions* options) {
             tokenizer->operators[i] = string_duplicate(default_operators[i]);
         }
     }
-    
-    // Sort operators by length (longest first)
-    qsort(tokenizer->operators, tokenizer->operators_count, sizeof(char*), compare_operators);
+    tokenizer->operator_kinds = malloc(sizeof(OperatorKind) * tokenizer->operators_count);
+    for (int i = 0; i < tokenizer->operators_count; i++) {
+        tokenizer->operator_kinds[i] = operator_from_string(tokenizer->operators[i]);
+    }
     
     // Setup delimiters
     if (tokenizer->options.delimiters && tokenizer->options.delimiters_count > 0) {
@@ -236,6 +1193,18 @@ Tokenizer* create_tokenizer(TokenizerOptions* options) {
         }
     }
     
+    punct_dfa_build(&tokenizer->punct, tokenizer->operators, tokenizer->operators_count,
+                    tokenizer->delimiters, tokenizer->delimiters_count);
+    
+    // The generated matchers only know the default sets
+    tokenizer->generated = false;
+#ifdef GENERATED_LEXER_FINGERPRINT
+    tokenizer->generated = !(tokenizer->options.keywords && tokenizer->options.keywords_count > 0) &&
+                           !(tokenizer->options.operators && tokenizer->options.operators_count > 0) &&
+                           !(tokenizer->options.delimiters && tokenizer->options.delimiters_count > 0) &&
+                           default_tables_fingerprint() == GENERATED_LEXER_FINGERPRINT;
+#endif
+    
     return tokenizer;
 }
 
@@ -246,230 +1215,1253 @@ void free_tokenizer(Tokenizer* tokenizer) {
         free(tokenizer->keywords[i]);
     }
     free(tokenizer->keywords);
+    keyword_table_free(&tokenizer->keyword_table);
     
     for (int i = 0; i < tokenizer->operators_count; i++) {
         free(tokenizer->operators[i]);
     }
     free(tokenizer->operators);
+    free(tokenizer->operator_kinds);
     
     for (int i = 0; i < tokenizer->delimiters_count; i++) {
         free(tokenizer->delimiters[i]);
     }
     free(tokenizer->delimiters);
+    punct_dfa_free(&tokenizer->punct);
     
     free(tokenizer);
 }
 
 bool is_delimiter(Tokenizer* tokenizer, char ch) {
-    char str[2] = {ch, '\0'};
-    for (int i = 0; i < tokenizer->delimiters_count; i++) {
-        if (strcmp(tokenizer->delimiters[i], str) == 0) {
-            return true;
-        }
-    }
-    return false;
+    int state = tokenizer->punct.dispatch[(unsigned char)ch];
+    return state >= 0 && tokenizer->punct.states[state].accept == TOKEN_DELIMITER;
 }
 
-// Main tokenization function
-TokenArray* tokenize(Tokenizer* tokenizer, const char* input) {
+// Streaming lexer
+void lexer_init(Lexer* lexer, Tokenizer* tokenizer, const char* input, size_t length) {
+    lexer->tokenizer = tokenizer;
+    lexer->input = input;
+    lexer->length = length;
+    lexer->pos = 0;
+    lexer->line = 1;
+    lexer->line_start = 0;
+    lexer->copy_text = !tokenizer->options.zero_copy;
+    lexer->track_positions = !tokenizer->options.lazy_positions;
+    lexer->intern_atoms = tokenizer->options.intern_atoms;
+    lexer->finished = false;
+    lexer->lookahead = NULL;
+    lexer->lookahead_start = 0;
+    lexer->lookahead_count = 0;
+    lexer->lookahead_capacity = 0;
+}
+
+Lexer* create_lexer(Tokenizer* tokenizer, const char* input, size_t length) {
     if (!tokenizer || !input) return NULL;
     
-    TokenArray* tokens = create_token_array();
-    if (!tokens) return NULL;
+    Lexer* lexer = malloc(sizeof(Lexer));
+    if (lexer) {
+        lexer_init(lexer, tokenizer, input, length);
+    }
+    return lexer;
+}
+
+// Release tokens still buffered by lexer_peek()
+void lexer_reset_lookahead(Lexer* lexer) {
+    for (int i = 0; i < lexer->lookahead_count; i++) {
+        int idx = (lexer->lookahead_start + i) % lexer->lookahead_capacity;
+        free_token(&lexer->lookahead[idx]);
+    }
+    free(lexer->lookahead);
+    lexer->lookahead = NULL;
+    lexer->lookahead_start = 0;
+    lexer->lookahead_count = 0;
+    lexer->lookahead_capacity = 0;
+}
+
+void free_lexer(Lexer* lexer) {
+    if (!lexer) return;
     
-    int len = strlen(input);
-    int i = 0;
-    int line = 1;
-    int column = 1;
+    lexer_reset_lookahead(lexer);
+    free(lexer);
+}
+
+// Account for the newlines in input[from, to)
+static void lexer_advance_lines(const ScanKernels* scan, const char* input, size_t from, size_t to,
+                                int* line, size_t* line_start) {
+    size_t nl = scan->find_newline(input, from, to);
+    while (nl < to) {
+        (*line)++;
+        *line_start = nl + 1;
+        nl = scan->find_newline(input, nl + 1, to);
+    }
+}
+
+// Scan the next token from the input, skipping whitespace and comments
+// unless the tokenizer options ask for them
+static Token lexer_scan(Lexer* lexer) {
+    Tokenizer* tokenizer = lexer->tokenizer;
+    const ScanKernels* scan = tokenizer->kernels;
+    const char* input = lexer->input;
+    size_t len = lexer->length;
+    size_t i = lexer->pos;
+    bool copy = lexer->copy_text;
+    // Interned names take their text from the intern table
+    bool intern = lexer->intern_atoms;
+    bool copy_names = copy && !intern;
+    
+    // Columns are derived from the offset of the current line start; in
+    // lazy mode positions are not tracked at all
+    bool track = lexer->track_positions;
+    int line = lexer->line;
+    size_t line_start = lexer->line_start;
+    int start_line = 0;
+    int start_column = 0;
+    Token token;
     
     while (i < len) {
-        char ch = input[i];
-        int start_line = line;
-        int start_column = column;
-        
-        // Track line and column
-        if (ch == '\n') {
-            line++;
-            column = 1;
-        } else {
-            column++;
-        }
+        unsigned char ch = (unsigned char)input[i];
+        size_t start = i;
         
         // Whitespace
-        if (isspace(ch)) {
-            if (tokenizer->options.include_whitespace) {
-                char whitespace[1000] = {0};
-                int ws_idx = 0;
-                while (i < len && isspace(input[i]) && ws_idx < 999) {
-                    whitespace[ws_idx++] = input[i];
-                    if (input[i] == '\n') {
-                        line++;
-                        column = 1;
-                    } else {
-                        column++;
-                    }
-                    i++;
-                }
-                whitespace[ws_idx] = '\0';
-                Token token = create_token(TOKEN_WHITESPACE, whitespace, start_line, start_column);
-                add_token(tokens, token);
-            } else {
-                i++;
+        if (char_is_space(ch)) {
+            i = scan->skip_whitespace(input, i, len);
+            if (!tokenizer->options.include_whitespace) {
+                if (track) lexer_advance_lines(scan, input, start, i, &line, &line_start);
+                continue;
             }
-            continue;
+            if (track) {
+                start_line = line;
+                start_column = (int)(start - line_start) + 1;
+                lexer_advance_lines(scan, input, start, i, &line, &line_start);
+            }
+            token = create_token_slice(TOKEN_WHITESPACE, input, start, i - start,
+                                       start_line, start_column, copy);
+            goto emit;
+        }
+        
+        if (track) {
+            start_line = line;
+            start_column = (int)(start - line_start) + 1;
         }
         
         // Single line comments
         if (ch == '/' && i + 1 < len && input[i + 1] == '/') {
-            char comment[1000] = {0};
-            int comment_idx = 0;
-            while (i < len && input[i] != '\n' && comment_idx < 999) {
-                comment[comment_idx++] = input[i++];
-                column++;
-            }
-            comment[comment_idx] = '\0';
+            i = scan->find_newline(input, i, len);
             if (tokenizer->options.include_comments) {
-                Token token = create_token(TOKEN_COMMENT, comment, start_line, start_column);
-                add_token(tokens, token);
+                token = create_token_slice(TOKEN_COMMENT, input, start, i - start,
+                                           start_line, start_column, copy);
+                goto emit;
             }
             continue;
         }
         
         // Multi-line comments
         if (ch == '/' && i + 1 < len && input[i + 1] == '*') {
-            char comment[2000] = {'/', '*'};
-            int comment_idx = 2;
             i += 2;
-            column += 2;
             
-            while (i < len - 1 && comment_idx < 1998) {
-                if (input[i] == '*' && input[i + 1] == '/') {
-                    comment[comment_idx++] = '*';
-                    comment[comment_idx++] = '/';
-                    i += 2;
-                    column += 2;
+            // Jump from '*' to '*' until one closes the comment
+            size_t body = i;
+            size_t end = len > i + 1 ? len - 1 : i;
+            bool closed = false;
+            while (i < end) {
+                i = scan->find_star(input, i, end);
+                if (i < end && input[i + 1] == '/') {
+                    closed = true;
                     break;
                 }
-                comment[comment_idx++] = input[i];
-                if (input[i] == '\n') {
-                    line++;
-                    column = 1;
-                } else {
-                    column++;
-                }
-                i++;
+                if (i < end) i++;
+            }
+            if (track) lexer_advance_lines(scan, input, body, i, &line, &line_start);
+            if (closed) {
+                i += 2;
             }
-            comment[comment_idx] = '\0';
             
             if (tokenizer->options.include_comments) {
-                Token token = create_token(TOKEN_COMMENT, comment, start_line, start_column);
-                add_token(tokens, token);
+                token = create_token_slice(TOKEN_COMMENT, input, start, i - start,
+                                           start_line, start_column, copy);
+                goto emit;
             }
             continue;
         }
         
         // Numbers
-        if (isdigit(ch)) {
-            char num[100] = {0};
-            int num_idx = 0;
-            while (i < len && (isdigit(input[i]) || input[i] == '.') && num_idx < 99) {
-                num[num_idx++] = input[i++];
-                column++;
-            }
-            num[num_idx] = '\0';
-            Token token = create_token(TOKEN_NUMBER, num, start_line, start_column);
-            add_token(tokens, token);
-            continue;
+        if (char_is_digit(ch)) {
+            NumberValue number;
+            i = scan_number(scan, input, i, len, &number);
+            token = create_token_slice(TOKEN_NUMBER, input, start, i - start,
+                                       start_line, start_column, copy);
+            token.number = number;
+            goto emit;
         }
         
         // Identifiers and keywords
-        if (isalpha(ch) || ch == '_') {
-            char ident[256] = {0};
-            int ident_idx = 0;
-            while (i < len && (isalnum(input[i]) || input[i] == '_') && ident_idx < 255) {
-                ident[ident_idx++] = input[i++];
-                column++;
-            }
-            ident[ident_idx] = '\0';
+        if (char_is_ident_start(ch)) {
+            i = scan->scan_identifier(input, i, len);
             
-            TokenType type = is_keyword(tokenizer, ident) ? TOKEN_KEYWORD : TOKEN_IDENTIFIER;
-            Token token = create_token(type, ident, start_line, start_column);
-            add_token(tokens, token);
-            continue;
+            TokenType type = is_keyword_n(tokenizer, input + start, i - start) ? TOKEN_KEYWORD : TOKEN_IDENTIFIER;
+            token = create_token_slice(type, input, start, i - start,
+                                       start_line, start_column, copy_names);
+            if (intern) token.atom = intern_string_n(input + start, i - start);
+            goto emit;
         }
         
         // Strings
         if (ch == '"' || ch == '\'') {
-            char quote = ch;
+            char quote = (char)ch;
             i++; // skip opening quote
-            column++;
-            
-            char str[1000] = {0};
-            int str_idx = 0;
             
-            while (i < len && input[i] != quote && str_idx < 999) {
-                if (input[i] == '\\' && i + 1 < len) {
-                    str[str_idx++] = input[i++]; // backslash
-                    if (str_idx < 999) {
-                        str[str_idx++] = input[i++]; // escaped character
-                    }
-                    column += 2;
-                } else {
-                    str[str_idx++] = input[i++];
-                    column++;
-                }
+            size_t content_start = i;
+            for (;;) {
+                i = scan->find_quote_or_escape(input, i, len, quote);
+                if (i >= len || input[i] == quote) break;
+                // Backslash: skip it and the escaped character
+                i += (i + 1 < len) ? 2 : 1;
             }
+            if (i > len) i = len;
+            size_t content_end = i;
+            if (track) lexer_advance_lines(scan, input, content_start, content_end, &line, &line_start);
             
             if (i < len) {
                 i++; // skip closing quote
-                column++;
             }
-            str[str_idx] = '\0';
-            Token token = create_token(TOKEN_STRING, str, start_line, start_column);
-            add_token(tokens, token);
-            continue;
+            token = create_token_slice(TOKEN_STRING, input, content_start,
+                                       content_end - content_start,
+                                       start_line, start_column, copy_names);
+            if (intern) token.atom = intern_string_n(input + content_start, content_end - content_start);
+            goto emit;
+        }
+        
+        // Operators and delimiters (longest match)
+        TokenType punct_type = TOKEN_EOF;
+        int punct_index = -1;
+#ifdef GENERATED_LEXER_FINGERPRINT
+        size_t punct_len = tokenizer->generated
+            ? generated_punct_match(input, i, len, &punct_type, &punct_index)
+            : punct_match(&tokenizer->punct, input, i, len, &punct_type, &punct_index);
+#else
+        size_t punct_len = punct_match(&tokenizer->punct, input, i, len, &punct_type, &punct_index);
+#endif
+        if (punct_len > 0) {
+            token = create_token_slice(punct_type, input, i, punct_len,
+                                       start_line, start_column, copy);
+            if (punct_type == TOKEN_OPERATOR) token.op = tokenizer->operator_kinds[punct_index];
+            i += punct_len;
+            goto emit;
         }
         
-        // Operators (check longer ones first)
-        bool found = false;
-        for (int op_idx = 0; op_idx < tokenizer->operators_count; op_idx++) {
-            char* op = tokenizer->operators[op_idx];
-            int op_len = strlen(op);
+        // Unknown character
+        if (!tokenizer->options.skip_unknown) {
+            token = create_token_slice(TOKEN_IDENTIFIER, input, i, 1,
+                                       start_line, start_column, copy);
+            i++;
+            goto emit;
+        }
+        i++;
+    }
+    
+    // End of input
+    if (track) {
+        start_line = line;
+        start_column = (int)(len - line_start) + 1;
+    }
+    token = create_token_slice(TOKEN_EOF, input, len, 0, start_line, start_column, copy);
+    lexer->finished = true;
+    
+emit:
+    lexer->pos = i;
+    lexer->line = line;
+    lexer->line_start = line_start;
+    return token;
+}
+
+// Next token from the stream. The caller owns the returned token and
+// releases it with free_token(). Once the input is exhausted every call
+// returns an EOF token.
+Token lexer_next(Lexer* lexer) {
+    if (lexer->lookahead_count > 0) {
+        Token token = lexer->lookahead[lexer->lookahead_start];
+        lexer->lookahead_start = (lexer->lookahead_start + 1) % lexer->lookahead_capacity;
+        lexer->lookahead_count--;
+        return token;
+    }
+    return lexer_scan(lexer);
+}
+
+// Look k tokens ahead (k = 0 is the token lexer_next() returns next)
+// without consuming anything. The token stays owned by the lexer.
+const Token* lexer_peek(Lexer* lexer, int k) {
+    if (!lexer || k < 0) return NULL;
+    
+    if (k >= lexer->lookahead_capacity) {
+        int capacity = lexer->lookahead_capacity ? lexer->lookahead_capacity : 4;
+        while (capacity <= k) {
+            capacity *= 2;
+        }
+        Token* ring = malloc(sizeof(Token) * capacity);
+        if (!ring) return NULL;
+        for (int i = 0; i < lexer->lookahead_count; i++) {
+            ring[i] = lexer->lookahead[(lexer->lookahead_start + i) % lexer->lookahead_capacity];
+        }
+        free(lexer->lookahead);
+        lexer->lookahead = ring;
+        lexer->lookahead_start = 0;
+        lexer->lookahead_capacity = capacity;
+    }
+    
+    while (lexer->lookahead_count <= k) {
+        int idx = (lexer->lookahead_start + lexer->lookahead_count) % lexer->lookahead_capacity;
+        lexer->lookahead[idx] = lexer_scan(lexer);
+        lexer->lookahead_count++;
+    }
+    return &lexer->lookahead[(lexer->lookahead_start + k) % lexer->lookahead_capacity];
+}
+
+// Main tokenization function
+// Tokenize input[0, length); the input does not need a NUL terminator.
+TokenArray* tokenize_n(Tokenizer* tokenizer, const char* input, size_t length) {
+    if (!tokenizer || !input) return NULL;
+    
+    TokenArray* tokens = create_token_array_with_capacity(token_array_initial_capacity(length));
+    if (!tokens) return NULL;
+    
+    Lexer lexer;
+    lexer_init(&lexer, tokenizer, input, length);
+    tokens->source = input;
+    tokens->source_length = length;
+    
+    Token token;
+    do {
+        token = lexer_scan(&lexer);
+        if (!add_token(tokens, token)) {
+            free_token_array(tokens);
+            return NULL;
+        }
+    } while (token.type != TOKEN_EOF);
+    
+    return tokens;
+}
+
+TokenArray* tokenize(Tokenizer* tokenizer, const char* input) {
+    if (!input) return NULL;
+    return tokenize_n(tokenizer, input, strlen(input));
+}
+
+// Parallel tokenization
+// The input is cut into chunks that start right after a newline and each
+// chunk is lexed on its own thread as if a token started there. That guess
+// is wrong when the cut falls inside a string or block comment, so the
+// results are stitched serially: the lexer carries no state between tokens
+// other than its position, so once the stitched stream reaches a position
+// where a chunk's lexer also resumed, the rest of that chunk is exactly
+// what serial lexing would produce. Until such a sync point is found the
+// stitcher lexes on its own.
+#define PARALLEL_MIN_CHUNK (1024 * 1024)
+
+typedef struct {
+    Tokenizer* tokenizer;
+    const char* input;
+    size_t length;
+    size_t start;           // chunk is [start, end); start follows a newline
+    size_t end;
+    bool copy_text;
+    bool track_positions;
+    TokenArray* tokens;     // lines counted from 1 at start
+    size_t* ends;           // lexer position after each token, SIZE_MAX after EOF
+    size_t resume;          // position where the chunk's lexer stopped
+    size_t newlines;        // newlines in [start, end)
+    int first_line;
+    bool failed;
+} LexChunk;
+
+static void* lex_chunk(void* arg) {
+    LexChunk* chunk = arg;
+    const ScanKernels* scan = chunk->tokenizer->kernels;
+    
+    int capacity = token_array_initial_capacity(chunk->end - chunk->start);
+    chunk->tokens = create_token_array_with_capacity(capacity);
+    chunk->ends = malloc(sizeof(size_t) * (size_t)capacity);
+    if (!chunk->tokens || !chunk->ends) {
+        chunk->failed = true;
+        return NULL;
+    }
+    
+    Lexer lexer;
+    lexer_init(&lexer, chunk->tokenizer, chunk->input, chunk->length);
+    lexer.pos = chunk->start;
+    lexer.line_start = chunk->start;
+    lexer.copy_text = chunk->copy_text;
+    lexer.track_positions = chunk->track_positions;
+    lexer.intern_atoms = false;     // the intern table is not thread-safe
+    
+    // Lex until the next chunk's start has been reached
+    Token token;
+    do {
+        if (lexer.pos >= chunk->end && chunk->end < chunk->length) break;
+        token = lexer_scan(&lexer);
+        if (!add_token(chunk->tokens, token)) {
+            chunk->failed = true;
+            return NULL;
+        }
+        if (chunk->tokens->count > capacity) {
+            capacity = chunk->tokens->capacity;
+            size_t* ends = realloc(chunk->ends, sizeof(size_t) * (size_t)capacity);
+            if (!ends) {
+                chunk->failed = true;
+                return NULL;
+            }
+            chunk->ends = ends;
+        }
+        // Nothing resumes after EOF; a stream that reaches the end of the
+        // input still has to produce its own EOF token
+        chunk->ends[chunk->tokens->count - 1] = token.type == TOKEN_EOF ? SIZE_MAX : lexer.pos;
+    } while (token.type != TOKEN_EOF);
+    chunk->resume = lexer.pos;
+    
+    size_t nl = scan->find_newline(chunk->input, chunk->start, chunk->end);
+    while (nl < chunk->end) {
+        chunk->newlines++;
+        nl = scan->find_newline(chunk->input, nl + 1, chunk->end);
+    }
+    return NULL;
+}
+
+// Move tokens [from, count) of a chunk to the output, rebasing their lines
+static bool lex_chunk_take(TokenArray* out, LexChunk* chunk, int from) {
+    for (int k = from; k < chunk->tokens->count; k++) {
+        Token token = chunk->tokens->tokens[k];
+        chunk->tokens->tokens[k].value = NULL;
+        if (chunk->track_positions) token.line += chunk->first_line - 1;
+        if (!add_token(out, token)) return false;
+    }
+    return true;
+}
+
+// Line and line start at pos, from the chunks' newline counts
+static void lex_chunk_position(const LexChunk* chunks, int chunk_count, size_t pos,
+                               int* line, size_t* line_start) {
+    int c = chunk_count - 1;
+    while (c > 0 && chunks[c].start > pos) c--;
+    const LexChunk* chunk = &chunks[c];
+    const ScanKernels* scan = chunk->tokenizer->kernels;
+    
+    *line = chunk->first_line;
+    *line_start = chunk->start;
+    size_t nl = scan->find_newline(chunk->input, chunk->start, pos);
+    while (nl < pos) {
+        (*line)++;
+        *line_start = nl + 1;
+        nl = scan->find_newline(chunk->input, nl + 1, pos);
+    }
+}
+
+// Splice the chunk results into one stream, re-lexing serially wherever a
+// chunk's speculative start was wrong
+static bool lex_chunks_stitch(TokenArray* out, LexChunk* chunks, int chunk_count) {
+    if (!lex_chunk_take(out, &chunks[0], 0)) return false;
+    size_t cur = chunks[0].resume;
+    bool done = out->count > 0 && out->tokens[out->count - 1].type == TOKEN_EOF;
+    
+    Lexer serial;
+    bool serial_active = false;
+    
+    for (int c = 1; c < chunk_count && !done; c++) {
+        LexChunk* chunk = &chunks[c];
+        int count = chunk->tokens->count;
+        
+        // Sync point k is where the chunk's lexer stood before token k
+        int k = 0;
+        for (;;) {
+            while (k <= count && (k == 0 ? chunk->start : chunk->ends[k - 1]) < cur) k++;
+            if (k > count) break;   // passed this chunk without syncing
             
-            if (i + op_len <= len && strncmp(input + i, op, op_len) == 0) {
-                Token token = create_token(TOKEN_OPERATOR, op, start_line, start_column);
-                add_token(tokens, token);
-                i += op_len;
-                column += op_len;
-                found = true;
+            if ((k == 0 ? chunk->start : chunk->ends[k - 1]) == cur) {
+                if (!lex_chunk_take(out, chunk, k)) return false;
+                cur = chunk->resume;
+                done = out->count > 0 && out->tokens[out->count - 1].type == TOKEN_EOF;
+                serial_active = false;
+                break;
+            }
+            
+            if (!serial_active) {
+                lexer_init(&serial, chunk->tokenizer, chunk->input, chunk->length);
+                serial.pos = cur;
+                serial.copy_text = chunk->copy_text;
+                serial.track_positions = chunk->track_positions;
+                serial.intern_atoms = false;
+                if (serial.track_positions) {
+                    lex_chunk_position(chunks, chunk_count, cur, &serial.line, &serial.line_start);
+                }
+                serial_active = true;
+            }
+            Token token = lexer_scan(&serial);
+            if (!add_token(out, token)) return false;
+            cur = serial.pos;
+            if (token.type == TOKEN_EOF) {
+                done = true;
                 break;
             }
         }
-        if (found) continue;
-        
-        // Delimiters
-        if (is_delimiter(tokenizer, ch)) {
-            char delim[2] = {ch, '\0'};
-            Token token = create_token(TOKEN_DELIMITER, delim, start_line, start_column);
-            add_token(tokens, token);
-            i++;
-            continue;
+    }
+    return done;
+}
+
+// Tokenize input[0, length) on up to `threads` threads (0 picks one per
+// online CPU). The result is identical to tokenize_n(); inputs too small
+// to be worth splitting are tokenized serially.
+TokenArray* tokenize_parallel(Tokenizer* tokenizer, const char* input, size_t length, int threads) {
+    if (!tokenizer || !input) return NULL;
+    
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    size_t max_chunks = length / PARALLEL_MIN_CHUNK;
+    int chunk_count = (size_t)threads < max_chunks ? threads : (int)max_chunks;
+    if (chunk_count < 2) return tokenize_n(tokenizer, input, length);
+    
+    LexChunk* chunks = calloc((size_t)chunk_count, sizeof(LexChunk));
+    pthread_t* workers = malloc(sizeof(pthread_t) * (size_t)chunk_count);
+    bool* started = calloc((size_t)chunk_count, sizeof(bool));
+    TokenArray* out = NULL;
+    if (!chunks || !workers || !started) goto cleanup;
+    
+    // Cut points just after a newline
+    bool intern = tokenizer->options.intern_atoms;
+    int used = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        size_t start = 0;
+        if (c > 0) {
+            const char* nl = memchr(input + length / (size_t)chunk_count * (size_t)c, '\n',
+                                    length - length / (size_t)chunk_count * (size_t)c);
+            if (!nl) break;
+            start = (size_t)(nl - input) + 1;
+            if (start >= length || start <= chunks[used - 1].start) continue;
+        }
+        LexChunk* chunk = &chunks[used++];
+        chunk->tokenizer = tokenizer;
+        chunk->input = input;
+        chunk->length = length;
+        chunk->start = start;
+        chunk->copy_text = !tokenizer->options.zero_copy;
+        chunk->track_positions = !tokenizer->options.lazy_positions;
+    }
+    for (int c = 0; c < used; c++) {
+        chunks[c].end = c + 1 < used ? chunks[c + 1].start : length;
+    }
+    
+    // Lex every chunk but the first on a worker; the calling thread takes
+    // the first one (and any chunk whose thread could not be started)
+    for (int c = 1; c < used; c++) {
+        started[c] = pthread_create(&workers[c], NULL, lex_chunk, &chunks[c]) == 0;
+    }
+    lex_chunk(&chunks[0]);
+    for (int c = 1; c < used; c++) {
+        if (started[c]) {
+            pthread_join(workers[c], NULL);
+        } else {
+            lex_chunk(&chunks[c]);
+        }
+    }
+    
+    int total = 0;
+    int first_line = 1;
+    for (int c = 0; c < used; c++) {
+        if (chunks[c].failed) goto cleanup;
+        chunks[c].first_line = first_line;
+        first_line += (int)chunks[c].newlines;
+        total += chunks[c].tokens->count;
+    }
+    
+    out = create_token_array_with_capacity(total);
+    if (!out) goto cleanup;
+    out->source = input;
+    out->source_length = length;
+    if (!lex_chunks_stitch(out, chunks, used)) {
+        free_token_array(out);
+        out = NULL;
+        goto cleanup;
+    }
+    
+    // Names are interned once the stream is final and, as in serial
+    // lexing, carry no copy of their text
+    if (intern) {
+        for (int i = 0; i < out->count; i++) {
+            Token* token = &out->tokens[i];
+            // Unknown characters also come out as identifiers but are not names
+            bool name = token->type == TOKEN_KEYWORD || token->type == TOKEN_STRING ||
+                        (token->type == TOKEN_IDENTIFIER &&
+                         char_is_ident_start((unsigned char)input[token->offset]));
+            if (name) {
+                token->atom = intern_string_n(input + token->offset, token->length);
+                free(token->value);
+                token->value = NULL;
+            }
+        }
+    }
+    
+cleanup:
+    if (chunks) {
+        for (int c = 0; c < chunk_count; c++) {
+            free_token_array(chunks[c].tokens);
+            free(chunks[c].ends);
+        }
+    }
+    free(chunks);
+    free(workers);
+    free(started);
+    return out;
+}
+
+// File input
+#define SOURCE_READ_CHUNK (64 * 1024)
+
+static bool source_buffer_read_fd(SourceBuffer* buffer, int fd) {
+    size_t capacity = SOURCE_READ_CHUNK;
+    size_t length = 0;
+    char* data = malloc(capacity);
+    if (!data) return false;
+    
+    for (;;) {
+        if (capacity - length < SOURCE_READ_CHUNK) {
+            char* grown = realloc(data, capacity * 2);
+            if (!grown) {
+                free(data);
+                return false;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, data + length, capacity - length);
+        if (n < 0) {
+            free(data);
+            return false;
+        }
+        if (n == 0) break;
+        length += (size_t)n;
+    }
+    
+    if (length == 0) {
+        // Empty input keeps the static "" buffer so close has nothing to free
+        free(data);
+        return true;
+    }
+    buffer->data = data;
+    buffer->length = length;
+    buffer->mapped = false;
+    return true;
+}
+
+// Load a source file. Regular files are memory-mapped with a sequential
+// access hint; anything else (pipes, terminals, "-" for stdin) is read in
+// chunks. Returns NULL on error.
+SourceBuffer* source_buffer_open(const char* path) {
+    if (!path) return NULL;
+    
+    SourceBuffer* buffer = malloc(sizeof(SourceBuffer));
+    if (!buffer) return NULL;
+    buffer->data = "";
+    buffer->length = 0;
+    buffer->mapped = false;
+    
+    bool use_stdin = strcmp(path, "-") == 0;
+    int fd = use_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        free(buffer);
+        return NULL;
+    }
+    
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+            buffer->data = data;
+            buffer->length = (size_t)st.st_size;
+            buffer->mapped = true;
+        } else {
+            ok = source_buffer_read_fd(buffer, fd);
+        }
+    } else if (ok && !(S_ISREG(st.st_mode) && st.st_size == 0)) {
+        ok = source_buffer_read_fd(buffer, fd);
+    }
+    
+    if (!use_stdin) {
+        close(fd);
+    }
+    if (!ok) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+void source_buffer_close(SourceBuffer* buffer) {
+    if (!buffer) return;
+    
+    if (buffer->mapped) {
+        munmap((void*)buffer->data, buffer->length);
+    } else if (buffer->length > 0) {
+        free((void*)buffer->data);
+    }
+    free(buffer);
+}
+
+// Tokenize a file ("-" reads stdin). The returned array owns the loaded
+// input, so zero-copy tokens stay valid until free_token_array().
+TokenArray* tokenize_file(Tokenizer* tokenizer, const char* path) {
+    if (!tokenizer) return NULL;
+    
+    SourceBuffer* buffer = source_buffer_open(path);
+    if (!buffer) return NULL;
+    
+    TokenArray* tokens = tokenize_n(tokenizer, buffer->data, buffer->length);
+    if (!tokens) {
+        source_buffer_close(buffer);
+        return NULL;
+    }
+    tokens->owned_source = buffer;
+    return tokens;
+}
+
+// Compact token buffer
+TokenBuffer* create_token_buffer(size_t capacity) {
+    if (capacity < 1) capacity = 1;
+    
+    TokenBuffer* buffer = malloc(sizeof(TokenBuffer));
+    if (!buffer) return NULL;
+    buffer->types = malloc(sizeof(uint8_t) * capacity);
+    buffer->offsets = malloc(sizeof(uint32_t) * capacity);
+    buffer->lengths = malloc(sizeof(uint32_t) * capacity);
+    buffer->aux = malloc(sizeof(uint32_t) * capacity);
+    buffer->count = 0;
+    buffer->capacity = capacity;
+    buffer->numbers = NULL;
+    buffer->number_count = 0;
+    buffer->number_capacity = 0;
+    buffer->source = NULL;
+    buffer->source_length = 0;
+    buffer->owned_source = NULL;
+    buffer->mapping = NULL;
+    buffer->mapping_length = 0;
+    buffer->mapped_aux = false;
+    
+    if (!buffer->types || !buffer->offsets || !buffer->lengths || !buffer->aux) {
+        free(buffer->types);
+        free(buffer->offsets);
+        free(buffer->lengths);
+        free(buffer->aux);
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+void free_token_buffer(TokenBuffer* buffer) {
+    if (!buffer) return;
+    
+    if (buffer->mapping) {
+        if (!buffer->mapped_aux) free(buffer->aux);
+        munmap(buffer->mapping, buffer->mapping_length);
+    } else {
+        free(buffer->types);
+        free(buffer->offsets);
+        free(buffer->lengths);
+        free(buffer->aux);
+        free(buffer->numbers);
+    }
+    source_buffer_close(buffer->owned_source);
+    free(buffer);
+}
+
+static bool token_buffer_reserve(TokenBuffer* buffer, size_t capacity) {
+    if (capacity <= buffer->capacity) return true;
+    
+    uint8_t* types = realloc(buffer->types, sizeof(uint8_t) * capacity);
+    if (!types) return false;
+    buffer->types = types;
+    uint32_t* offsets = realloc(buffer->offsets, sizeof(uint32_t) * capacity);
+    if (!offsets) return false;
+    buffer->offsets = offsets;
+    uint32_t* lengths = realloc(buffer->lengths, sizeof(uint32_t) * capacity);
+    if (!lengths) return false;
+    buffer->lengths = lengths;
+    uint32_t* aux = realloc(buffer->aux, sizeof(uint32_t) * capacity);
+    if (!aux) return false;
+    buffer->aux = aux;
+    buffer->capacity = capacity;
+    return true;
+}
+
+bool token_buffer_push(TokenBuffer* buffer, const Token* token) {
+    if (buffer->count >= buffer->capacity &&
+        !token_buffer_reserve(buffer, buffer->capacity * 2)) {
+        return false;
+    }
+    buffer->types[buffer->count] = (uint8_t)token->type;
+    buffer->offsets[buffer->count] = (uint32_t)token->offset;
+    buffer->lengths[buffer->count] = (uint32_t)token->length;
+    buffer->aux[buffer->count] = token->atom;
+    if (token->number.kind != NUMBER_NONE) {
+        if (buffer->number_count >= buffer->number_capacity) {
+            size_t capacity = buffer->number_capacity ? buffer->number_capacity * 2 : 64;
+            NumberValue* numbers = realloc(buffer->numbers, sizeof(NumberValue) * capacity);
+            if (!numbers) return false;
+            buffer->numbers = numbers;
+            buffer->number_capacity = capacity;
+        }
+        buffer->aux[buffer->count] = (uint32_t)buffer->number_count;
+        buffer->numbers[buffer->number_count++] = token->number;
+    }
+    buffer->count++;
+    return true;
+}
+
+// Text of token i, as a slice of the source (not NUL-terminated)
+const char* token_buffer_text(const TokenBuffer* buffer, size_t index, size_t* length) {
+    if (!buffer || index >= buffer->count) return NULL;
+    if (length) *length = buffer->lengths[index];
+    return buffer->source + buffer->offsets[index];
+}
+
+// Atom of token i, ATOM_NONE unless it is a name interned by the tokenizer
+Atom token_buffer_atom(const TokenBuffer* buffer, size_t index) {
+    if (!buffer || index >= buffer->count) return ATOM_NONE;
+    TokenType type = (TokenType)buffer->types[index];
+    if (type != TOKEN_IDENTIFIER && type != TOKEN_KEYWORD && type != TOKEN_STRING) return ATOM_NONE;
+    return buffer->aux[index];
+}
+
+// Operator code of token i, OP_NONE unless it is an operator
+OperatorKind token_buffer_operator(const TokenBuffer* buffer, size_t index) {
+    if (!buffer || index >= buffer->count || buffer->types[index] != TOKEN_OPERATOR) return OP_NONE;
+    return (OperatorKind)buffer->aux[index];
+}
+
+// Decoded value of token i; kind is NUMBER_NONE for non-number tokens
+NumberValue token_buffer_number(const TokenBuffer* buffer, size_t index) {
+    NumberValue none;
+    none.kind = NUMBER_NONE;
+    if (!buffer || index >= buffer->count || buffer->types[index] != TOKEN_NUMBER) return none;
+    return buffer->numbers[buffer->aux[index]];
+}
+
+// Tokenize into a TokenBuffer sized from the input length. Inputs of 4 GiB
+// or more do not fit 32-bit offsets and are rejected.
+TokenBuffer* tokenize_to_buffer(Tokenizer* tokenizer, const char* input, size_t length) {
+    if (!tokenizer || !input || length >= UINT32_MAX) return NULL;
+    
+    TokenBuffer* buffer = create_token_buffer(estimate_token_count(length));
+    if (!buffer) return NULL;
+    buffer->source = input;
+    buffer->source_length = length;
+    
+    Lexer lexer;
+    lexer_init(&lexer, tokenizer, input, length);
+    lexer.copy_text = false;
+    lexer.track_positions = false;
+    
+    Token token;
+    do {
+        token = lexer_scan(&lexer);
+        if (!token_buffer_push(buffer, &token)) {
+            free_token_buffer(buffer);
+            return NULL;
+        }
+    } while (token.type != TOKEN_EOF);
+    
+    return buffer;
+}
+
+// Indices of all tokens of one type; no token data is copied
+TokenView* find_tokens_by_type_view(const TokenBuffer* buffer, TokenType type) {
+    if (!buffer) return NULL;
+    
+    size_t count = 0;
+    for (size_t i = 0; i < buffer->count; i++) {
+        count += buffer->types[i] == (uint8_t)type;
+    }
+    
+    TokenView* view = malloc(sizeof(TokenView));
+    if (!view) return NULL;
+    view->buffer = buffer;
+    view->count = 0;
+    view->indices = malloc(sizeof(uint32_t) * (count ? count : 1));
+    if (!view->indices) {
+        free(view);
+        return NULL;
+    }
+    for (size_t i = 0; i < buffer->count; i++) {
+        if (buffer->types[i] == (uint8_t)type) {
+            view->indices[view->count++] = (uint32_t)i;
+        }
+    }
+    return view;
+}
+
+void free_token_view(TokenView* view) {
+    if (!view) return;
+    
+    free(view->indices);
+    free(view);
+}
+
+// Token cache
+// XXH64 of the input, reading words in host byte order
+#define XXH_PRIME64_1 UINT64_C(0x9E3779B185EBCA87)
+#define XXH_PRIME64_2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define XXH_PRIME64_3 UINT64_C(0x165667B19E3779F9)
+#define XXH_PRIME64_4 UINT64_C(0x85EBCA77C2B2AE63)
+#define XXH_PRIME64_5 UINT64_C(0x27D4EB2F165667C5)
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t xxh_read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t xxh64(const void* data, size_t length, uint64_t seed) {
+    const unsigned char* p = data;
+    const unsigned char* end = p + length;
+    uint64_t hash;
+    
+    if (length >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        hash = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        hash = xxh_merge_round(hash, v1);
+        hash = xxh_merge_round(hash, v2);
+        hash = xxh_merge_round(hash, v3);
+        hash = xxh_merge_round(hash, v4);
+    } else {
+        hash = seed + XXH_PRIME64_5;
+    }
+    hash += (uint64_t)length;
+    
+    for (; p + 8 <= end; p += 8) {
+        hash ^= xxh_round(0, xxh_read64(p));
+        hash = xxh_rotl(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+        hash = xxh_rotl(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= (*p) * XXH_PRIME64_5;
+        hash = xxh_rotl(hash, 11) * XXH_PRIME64_1;
+    }
+    
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Cache file layout: the header, then offsets, lengths and aux (uint32
+// each), types (uint8), padding to 8 bytes and the decoded numbers. Name
+// atoms are process-local, so aux is stored as ATOM_NONE for names.
+#define TOKEN_CACHE_MAGIC 0x434b4f54u  // "TOKC"
+#define TOKEN_CACHE_VERSION 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t content_hash;
+    uint64_t config_hash;
+    uint64_t source_length;
+    uint64_t token_count;
+    uint64_t number_count;
+} TokenCacheHeader;
+
+static size_t token_cache_numbers_offset(size_t count) {
+    size_t offset = sizeof(TokenCacheHeader) + count * (3 * sizeof(uint32_t) + sizeof(uint8_t));
+    return (offset + 7) & ~(size_t)7;
+}
+
+// Everything about a tokenizer that changes what a TokenBuffer holds
+static uint64_t tokenizer_fingerprint(const Tokenizer* tokenizer) {
+    uint8_t flags[5] = {
+        TOKEN_CACHE_VERSION,
+        tokenizer->options.include_whitespace,
+        tokenizer->options.include_comments,
+        tokenizer->options.skip_unknown,
+        tokenizer->options.case_sensitive
+    };
+    uint64_t hash = xxh64(flags, sizeof(flags), 0);
+    char** sets[] = { tokenizer->keywords, tokenizer->operators, tokenizer->delimiters };
+    int counts[] = { tokenizer->keywords_count, tokenizer->operators_count, tokenizer->delimiters_count };
+    for (int set = 0; set < 3; set++) {
+        for (int i = 0; i < counts[set]; i++) {
+            // Include the NUL so adjacent strings cannot run together
+            hash = xxh64(sets[set][i], strlen(sets[set][i]) + 1, hash);
+        }
+        hash = xxh64(&counts[set], sizeof(counts[set]), hash);
+    }
+    return hash;
+}
+
+TokenCache* token_cache_open(const char* directory) {
+    if (!directory) return NULL;
+    if (mkdir(directory, 0777) != 0 && errno != EEXIST) return NULL;
+    
+    TokenCache* cache = malloc(sizeof(TokenCache));
+    if (!cache) return NULL;
+    cache->directory = string_duplicate(directory);
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->stores = 0;
+    if (!cache->directory) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void token_cache_close(TokenCache* cache) {
+    if (!cache) return;
+    
+    free(cache->directory);
+    free(cache);
+}
+
+static char* token_cache_path(const TokenCache* cache, uint64_t content_hash, uint64_t config_hash,
+                              const char* suffix) {
+    size_t size = strlen(cache->directory) + 2 + 16 + 1 + 16 + strlen(suffix) + 1;
+    char* path = malloc(size);
+    if (path) {
+        snprintf(path, size, "%s/%016llx-%016llx%s", cache->directory,
+                 (unsigned long long)content_hash, (unsigned long long)config_hash, suffix);
+    }
+    return path;
+}
+
+// Map a cache entry and point a TokenBuffer at it. NULL when the entry is
+// missing or does not match the input.
+// Check that a mapped entry is the one expected and is well formed before
+// anything reads it: the arrays fill the file exactly, every token has a
+// known type and lies inside the source, and every number and operator
+// index is in range. The tokens are read in place, so a damaged entry
+// whose hashes still match must not reach them.
+static bool token_cache_validate(const char* base, size_t size, const TokenCacheHeader* expected) {
+    const TokenCacheHeader* header = (const TokenCacheHeader*)base;
+    if (header->magic != TOKEN_CACHE_MAGIC || header->version != TOKEN_CACHE_VERSION ||
+        header->content_hash != expected->content_hash || header->config_hash != expected->config_hash ||
+        header->source_length != expected->source_length ||
+        header->token_count == 0 || header->token_count > size) {
+        return false;
+    }
+    size_t count = (size_t)header->token_count;
+    size_t numbers = token_cache_numbers_offset(count);
+    if (numbers > size || header->number_count > (size - numbers) / sizeof(NumberValue) ||
+        numbers + (size_t)header->number_count * sizeof(NumberValue) != size) {
+        return false;
+    }
+    
+    const uint32_t* offsets = (const uint32_t*)(base + sizeof(TokenCacheHeader));
+    const uint32_t* lengths = offsets + count;
+    const uint32_t* aux = lengths + count;
+    const uint8_t* types = (const uint8_t*)(aux + count);
+    const NumberValue* values = (const NumberValue*)(base + numbers);
+    size_t source_length = (size_t)header->source_length;
+    for (size_t i = 0; i < count; i++) {
+        if (types[i] > TOKEN_EOF || offsets[i] > source_length || lengths[i] > source_length - offsets[i]) {
+            return false;
+        }
+        if (types[i] == TOKEN_NUMBER && aux[i] >= header->number_count) return false;
+        if (types[i] == TOKEN_OPERATOR && aux[i] >= OP_COUNT) return false;
+    }
+    for (size_t i = 0; i < (size_t)header->number_count; i++) {
+        if (values[i].kind != NUMBER_INT && values[i].kind != NUMBER_FLOAT) return false;
+    }
+    return true;
+}
+
+static TokenBuffer* token_cache_load(const char* path, const TokenCacheHeader* expected,
+                                     const Tokenizer* tokenizer, const char* input) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(TokenCacheHeader)) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    size_t size = (size_t)st.st_size;
+    
+    const TokenCacheHeader* header = data;
+    size_t count = (size_t)header->token_count;
+    size_t numbers = token_cache_numbers_offset(count);
+    TokenBuffer* buffer = token_cache_validate(data, size, expected) ? malloc(sizeof(TokenBuffer)) : NULL;
+    if (!buffer) {
+        munmap(data, size);
+        return NULL;
+    }
+    
+    char* base = data;
+    buffer->offsets = (uint32_t*)(base + sizeof(TokenCacheHeader));
+    buffer->lengths = buffer->offsets + count;
+    buffer->aux = buffer->lengths + count;
+    buffer->types = (uint8_t*)(buffer->aux + count);
+    buffer->numbers = (NumberValue*)(base + numbers);
+    buffer->count = count;
+    buffer->capacity = count;
+    buffer->number_count = (size_t)header->number_count;
+    buffer->number_capacity = buffer->number_count;
+    buffer->source = input;
+    buffer->source_length = (size_t)header->source_length;
+    buffer->owned_source = NULL;
+    buffer->mapping = data;
+    buffer->mapping_length = size;
+    buffer->mapped_aux = true;
+    
+    // Re-intern names for this process
+    if (tokenizer->options.intern_atoms) {
+        uint32_t* aux = malloc(sizeof(uint32_t) * count);
+        if (!aux) {
+            munmap(data, size);
+            free(buffer);
+            return NULL;
         }
-        
-        // Unknown character
-        if (!tokenizer->options.skip_unknown) {
-            char unknown[2] = {ch, '\0'};
-            Token token = create_token(TOKEN_IDENTIFIER, unknown, start_line, start_column);
-            add_token(tokens, token);
+        memcpy(aux, buffer->aux, sizeof(uint32_t) * count);
+        for (size_t i = 0; i < count; i++) {
+            TokenType type = (TokenType)buffer->types[i];
+            bool name = type == TOKEN_KEYWORD || type == TOKEN_STRING ||
+                        (type == TOKEN_IDENTIFIER && buffer->lengths[i] > 0 &&
+                         char_is_ident_start((unsigned char)input[buffer->offsets[i]]));
+            if (name) aux[i] = intern_string_n(input + buffer->offsets[i], buffer->lengths[i]);
         }
-        i++;
+        buffer->aux = aux;
+        buffer->mapped_aux = false;
     }
+    return buffer;
+}
+
+// Write an entry to a temporary file and rename it into place, so readers
+// never see a partial entry
+static bool token_cache_store(const char* path, const TokenCacheHeader* header,
+                              const TokenBuffer* buffer) {
+    size_t tmp_size = strlen(path) + 32;
+    char* tmp = malloc(tmp_size);
+    if (!tmp) return false;
+    snprintf(tmp, tmp_size, "%s.tmp.%ld", path, (long)getpid());
     
-    // Add EOF token
-    Token eof_token = create_token(TOKEN_EOF, "", line, column);
-    add_token(tokens, eof_token);
+    FILE* out = fopen(tmp, "wb");
+    if (!out) {
+        free(tmp);
+        return false;
+    }
     
-    return tokens;
+    size_t count = buffer->count;
+    fwrite(header, sizeof(*header), 1, out);
+    fwrite(buffer->offsets, sizeof(uint32_t), count, out);
+    fwrite(buffer->lengths, sizeof(uint32_t), count, out);
+    for (size_t i = 0; i < count; i++) {
+        bool keep = buffer->types[i] == TOKEN_NUMBER || buffer->types[i] == TOKEN_OPERATOR;
+        uint32_t aux = keep ? buffer->aux[i] : ATOM_NONE;
+        fwrite(&aux, sizeof(aux), 1, out);
+    }
+    fwrite(buffer->types, sizeof(uint8_t), count, out);
+    static const char padding[8] = { 0 };
+    size_t written = sizeof(*header) + count * (3 * sizeof(uint32_t) + sizeof(uint8_t));
+    fwrite(padding, 1, token_cache_numbers_offset(count) - written, out);
+    if (buffer->number_count > 0) {
+        fwrite(buffer->numbers, sizeof(NumberValue), buffer->number_count, out);
+    }
+    
+    bool ok = !ferror(out);
+    ok &= fclose(out) == 0;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    free(tmp);
+    return ok;
+}
+
+// Tokenize through the cache: a hit maps the stored tokens and skips
+// lexing entirely, a miss tokenizes and stores the result. The buffer's
+// text slices refer to input, which must outlive it.
+TokenBuffer* tokenize_cached(TokenCache* cache, Tokenizer* tokenizer, const char* input, size_t length) {
+    if (!cache) return tokenize_to_buffer(tokenizer, input, length);
+    if (!tokenizer || !input) return NULL;
+    
+    TokenCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TOKEN_CACHE_MAGIC;
+    header.version = TOKEN_CACHE_VERSION;
+    header.content_hash = xxh64(input, length, 0);
+    header.config_hash = tokenizer_fingerprint(tokenizer);
+    header.source_length = length;
+    
+    char* path = token_cache_path(cache, header.content_hash, header.config_hash, ".tok");
+    if (!path) return NULL;
+    
+    TokenBuffer* buffer = token_cache_load(path, &header, tokenizer, input);
+    if (buffer) {
+        cache->hits++;
+        free(path);
+        return buffer;
+    }
+    
+    cache->misses++;
+    buffer = tokenize_to_buffer(tokenizer, input, length);
+    if (buffer) {
+        header.token_count = buffer->count;
+        header.number_count = buffer->number_count;
+        if (token_cache_store(path, &header, buffer)) cache->stores++;
+    }
+    free(path);
+    return buffer;
+}
+
+// Tokenize a file through the cache; the returned buffer owns the input
+TokenBuffer* tokenize_file_cached(TokenCache* cache, Tokenizer* tokenizer, const char* path) {
+    if (!tokenizer) return NULL;
+    
+    SourceBuffer* source = source_buffer_open(path);
+    if (!source) return NULL;
+    
+    TokenBuffer* buffer = tokenize_cached(cache, tokenizer, source->data, source->length);
+    if (!buffer) {
+        source_buffer_close(source);
+        return NULL;
+    }
+    buffer->owned_source = source;
+    return buffer;
 }
 
 // Utility functions
@@ -488,6 +2480,261 @@ const char* token_type_to_string(TokenType type) {
     }
 }
 
+// Position index
+// Offset where a token's lexeme starts (strings start at the opening quote)
+size_t token_start_offset(const Token* token) {
+    if (token->type == TOKEN_STRING && token->offset > 0) {
+        return token->offset - 1;
+    }
+    return token->offset;
+}
+
+// Build the table of line start offsets for the array's source. Done once,
+// on first use; the source must still be alive.
+bool token_array_build_line_index(TokenArray* tokens) {
+    if (!tokens || !tokens->source) return false;
+    if (tokens->line_starts) return true;
+    
+    const char* source = tokens->source;
+    size_t length = tokens->source_length;
+    size_t count = 1;
+    for (const char* nl = memchr(source, '\n', length); nl;
+         nl = memchr(nl + 1, '\n', length - (size_t)(nl + 1 - source))) {
+        count++;
+    }
+    
+    size_t* starts = malloc(sizeof(size_t) * count);
+    if (!starts) return false;
+    starts[0] = 0;
+    size_t line = 1;
+    for (const char* nl = memchr(source, '\n', length); nl;
+         nl = memchr(nl + 1, '\n', length - (size_t)(nl + 1 - source))) {
+        starts[line++] = (size_t)(nl + 1 - source);
+    }
+    
+    tokens->line_starts = starts;
+    tokens->line_count = count;
+    return true;
+}
+
+// Convert a byte offset to a 1-based line and column by binary search
+bool offset_to_position(TokenArray* tokens, size_t offset, int* line, int* column) {
+    if (!token_array_build_line_index(tokens)) return false;
+    
+    size_t lo = 0;
+    size_t hi = tokens->line_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tokens->line_starts[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (line) *line = (int)lo + 1;
+    if (column) *column = (int)(offset - tokens->line_starts[lo]) + 1;
+    return true;
+}
+
+// Convert a 1-based line and column to a byte offset
+bool position_to_offset(TokenArray* tokens, int line, int column, size_t* offset) {
+    if (line < 1 || column < 1 || !token_array_build_line_index(tokens)) return false;
+    if ((size_t)line > tokens->line_count) return false;
+    
+    size_t line_start = tokens->line_starts[line - 1];
+    size_t line_end = (size_t)line < tokens->line_count
+        ? tokens->line_starts[line] : tokens->source_length + 1;
+    size_t target = line_start + (size_t)(column - 1);
+    if (target >= line_end) return false;
+    
+    *offset = target;
+    return true;
+}
+
+// Line and column of a token, from the token itself when the lexer tracked
+// positions, otherwise from the line index
+bool token_position(TokenArray* tokens, const Token* token, int* line, int* column) {
+    if (!token) return false;
+    if (token->line > 0) {
+        if (line) *line = token->line;
+        if (column) *column = token->column;
+        return true;
+    }
+    return offset_to_position(tokens, token_start_offset(token), line, column);
+}
+
+// Token covering the byte at offset, or NULL. Tokens are ordered by offset,
+// so this is a binary search.
+Token* get_token_at_offset(TokenArray* tokens, size_t offset) {
+    if (!tokens || tokens->count == 0) return NULL;
+    
+    int lo = 0;
+    int hi = tokens->count;
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        if (token_start_offset(&tokens->tokens[mid]) <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    Token* token = &tokens->tokens[lo];
+    size_t start = token_start_offset(token);
+    size_t end = token->offset + token->length;
+    if (token->type == TOKEN_EOF || offset < start || offset >= end) {
+        return NULL;
+    }
+    return token;
+}
+
+// Get token at specific position
+Token* get_token_at_position(TokenArray* tokens, int line, int column) {
+    size_t offset;
+    if (!position_to_offset(tokens, line, column, &offset)) return NULL;
+    return get_token_at_offset(tokens, offset);
+}
+
+// Incremental re-lexing
+// Bytes past the end of a token the lexer may have looked at while
+// scanning it: the closing quote of a string plus the "e+1" of a number.
+// Operator matching can also read up to the longest operator past a shorter
+// match.
+#define RELEX_LOOKAHEAD 4
+
+// Update tokens after an edit that replaced source[offset, offset +
+// removed_length) with inserted_length bytes. source and length describe
+// the text after the edit. Lexing restarts one token before the first token
+// the edit can have touched and stops as soon as a new token starts where an
+// old one (shifted by the edit) did, since the lexer carries no other state
+// between tokens; the old tokens from there on are kept and only shifted.
+// The replaced range is reported through change.
+bool relex_tokens(Tokenizer* tokenizer, TokenArray* tokens, const char* source, size_t length,
+                  size_t offset, size_t removed_length, size_t inserted_length,
+                  TokenChange* change) {
+    if (!tokenizer || !tokens || !source || tokens->count == 0) return false;
+    if (offset > tokens->source_length || removed_length > tokens->source_length - offset) return false;
+    if (length != tokens->source_length - removed_length + inserted_length) return false;
+    
+    size_t lookahead = RELEX_LOOKAHEAD;
+    for (int i = 0; i < tokenizer->operators_count; i++) {
+        size_t op_length = strlen(tokenizer->operators[i]);
+        if (op_length > lookahead) lookahead = op_length;
+    }
+    for (int i = 0; i < tokenizer->delimiters_count; i++) {
+        size_t delim_length = strlen(tokenizer->delimiters[i]);
+        if (delim_length > lookahead) lookahead = delim_length;
+    }
+    
+    // First token that ends close enough to the edit to have seen it
+    int lo = 0;
+    int hi = tokens->count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const Token* token = &tokens->tokens[mid];
+        if (token->offset + token->length + lookahead < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    // The scan that produced it started at the end of the token before, so
+    // restart from that token's start
+    int first = lo > 0 ? lo - 1 : 0;
+    
+    Lexer lexer;
+    lexer_init(&lexer, tokenizer, source, length);
+    if (first > 0) {
+        const Token* restart = &tokens->tokens[first];
+        lexer.pos = token_start_offset(restart);
+        if (lexer.track_positions) {
+            lexer.line = restart->line;
+            lexer.line_start = lexer.pos - (size_t)(restart->column - 1);
+        }
+    }
+    
+    // Old tokens that start after the edit, once shifted, are sync candidates
+    size_t edit_end = offset + removed_length;
+    ptrdiff_t delta = (ptrdiff_t)inserted_length - (ptrdiff_t)removed_length;
+    int old = first;
+    
+    TokenArray* fresh = create_token_array_with_capacity(16);
+    if (!fresh) return false;
+    
+    int sync = tokens->count;
+    int sync_line = 0;
+    int line_delta = 0;
+    int column_delta = 0;
+    Token token;
+    do {
+        token = lexer_scan(&lexer);
+        size_t start = token_start_offset(&token);
+        while (old < tokens->count &&
+               (token_start_offset(&tokens->tokens[old]) < edit_end ||
+                (size_t)((ptrdiff_t)token_start_offset(&tokens->tokens[old]) + delta) < start)) {
+            old++;
+        }
+        if (old < tokens->count &&
+            (size_t)((ptrdiff_t)token_start_offset(&tokens->tokens[old]) + delta) == start) {
+            sync = old;
+            sync_line = tokens->tokens[old].line;
+            line_delta = token.line - tokens->tokens[old].line;
+            column_delta = token.column - tokens->tokens[old].column;
+            free_token(&token);
+            break;
+        }
+        if (!add_token(fresh, token)) {
+            free_token_array(fresh);
+            return false;
+        }
+    } while (token.type != TOKEN_EOF);
+    
+    // Splice the new tokens over [first, sync)
+    int removed = sync - first;
+    int inserted = fresh->count;
+    int count = tokens->count - removed + inserted;
+    if (count > tokens->capacity) {
+        Token* grown = realloc(tokens->tokens, sizeof(Token) * count);
+        if (!grown) {
+            free_token_array(fresh);
+            return false;
+        }
+        tokens->tokens = grown;
+        tokens->capacity = count;
+    }
+    for (int i = first; i < sync; i++) {
+        free_token(&tokens->tokens[i]);
+    }
+    memmove(&tokens->tokens[first + inserted], &tokens->tokens[sync],
+            sizeof(Token) * (size_t)(tokens->count - sync));
+    memcpy(&tokens->tokens[first], fresh->tokens, sizeof(Token) * (size_t)inserted);
+    tokens->count = count;
+    fresh->count = 0;
+    free_token_array(fresh);
+    
+    // Shift the kept tokens; only those on the line where the edit ended
+    // move sideways
+    for (int i = first + inserted; i < count; i++) {
+        Token* kept = &tokens->tokens[i];
+        kept->offset = (size_t)((ptrdiff_t)kept->offset + delta);
+        if (kept->line == sync_line) kept->column += column_delta;
+        kept->line += line_delta;
+    }
+    
+    tokens->source = source;
+    tokens->source_length = length;
+    free(tokens->line_starts);
+    tokens->line_starts = NULL;
+    tokens->line_count = 0;
+    
+    if (change) {
+        change->first = first;
+        change->removed = removed;
+        change->inserted = inserted;
+    }
+    return true;
+}
+
 // Pretty print tokens
 void pretty_print_tokens(TokenArray* tokens) {
     if (!tokens) return;
@@ -496,11 +2743,16 @@ void pretty_print_tokens(TokenArray* tokens) {
         Token* token = &tokens->tokens[i];
         if (token->type == TOKEN_EOF) continue;
         
-        printf("%-12s [%d:%d]   \"%s\"\n", 
+        size_t length;
+        const char* text = token_text(token, tokens->source, &length);
+        int line = 0;
+        int column = 0;
+        token_position(tokens, token, &line, &column);
+        printf("%-12s [%d:%d]   \"%.*s\"\n", 
                token_type_to_string(token->type),
-               token->line,
-               token->column,
-               token->value);
+               line,
+               column,
+               (int)length, text);
     }
 }
 
@@ -510,13 +2762,16 @@ TokenArray* find_tokens_by_type(TokenArray* tokens, TokenType type) {
     
     TokenArray* result = create_token_array();
     if (!result) return NULL;
+    result->source = tokens->source;
+    result->source_length = tokens->source_length;
     
     for (int i = 0; i < tokens->count; i++) {
         if (tokens->tokens[i].type == type) {
-            Token token = create_token(tokens->tokens[i].type, 
-                                     tokens->tokens[i].value,
-                                     tokens->tokens[i].line,
-                                     tokens->tokens[i].column);
+            // Zero-copy tokens only reference the source, so a shallow copy suffices
+            Token token = tokens->tokens[i];
+            if (token.value) {
+                token.value = string_duplicate(token.value);
+            }
             add_token(result, token);
         }
     }
@@ -524,21 +2779,6 @@ TokenArray* find_tokens_by_type(TokenArray* tokens, TokenType type) {
     return result;
 }
 
-// Get token at specific position
-Token* get_token_at_position(TokenArray* tokens, int line, int column) {
-    if (!tokens) return NULL;
-    
-    for (int i = 0; i < tokens->count; i++) {
-        Token* token = &tokens->tokens[i];
-        if (token->line == line && 
-            token->column <= column && 
-            column < token->column + (int)strlen(token->value)) {
-            return token;
-        }
-    }
-    return NULL;
-}
-
 // Convert tokens to string array
 char** tokenize_to_strings(TokenArray* tokens, int* count) {
     if (!tokens || !count) return NULL;
@@ -559,7 +2799,7 @@ char** tokenize_to_strings(TokenArray* tokens, int* count) {
     int idx = 0;
     for (int i = 0; i < tokens->count; i++) {
         if (tokens->tokens[i].type != TOKEN_EOF) {
-            strings[idx++] = string_duplicate(tokens->tokens[i].value);
+            strings[idx++] = token_text_copy(&tokens->tokens[i], tokens->source);
         }
     }
     
@@ -584,6 +2824,184 @@ TokenArray* quick_tokenize(const char* input) {
     return tokens;
 }
 
+// Table generator
+// `lexer --gen-lexer` writes lexer_default.inc: switch-based matchers for
+// the default keyword, operator and delimiter sets that replace the keyword
+// hash table and the operator DFA walk when a tokenizer uses the defaults.
+static void gen_char_literal(FILE* out, unsigned char ch) {
+    if (ch == '\'' || ch == '\\') {
+        fprintf(out, "'\\%c'", ch);
+    } else if (ch >= 0x20 && ch < 0x7f) {
+        fprintf(out, "'%c'", ch);
+    } else {
+        fprintf(out, "0x%02x", ch);
+    }
+}
+
+static void gen_indent(FILE* out, int depth) {
+    for (int i = 0; i < depth; i++) {
+        fprintf(out, "    ");
+    }
+}
+
+static bool gen_is_letter(unsigned char ch) {
+    return (ch | 0x20) >= 'a' && (ch | 0x20) <= 'z';
+}
+
+// Comparison of word[position] against a keyword byte. Letters fold case
+// when asked to by setting bit 0x20 on both sides, which only pairs a
+// letter with its other case.
+static void gen_keyword_byte(FILE* out, int position, unsigned char ch) {
+    if (gen_is_letter(ch)) {
+        fprintf(out, "((unsigned char)word[%d] | fold) == ", position);
+        if (ch >= 'a') {
+            gen_char_literal(out, ch);
+        } else {
+            fprintf(out, "(");
+            gen_char_literal(out, ch);
+            fprintf(out, " | fold)");
+        }
+    } else {
+        fprintf(out, "(unsigned char)word[%d] == ", position);
+        gen_char_literal(out, ch);
+    }
+}
+
+static void gen_keyword_matcher(FILE* out, const Tokenizer* tokenizer) {
+    size_t max_length = 0;
+    for (int i = 0; i < tokenizer->keywords_count; i++) {
+        size_t length = strlen(tokenizer->keywords[i]);
+        if (length > max_length) max_length = length;
+    }
+    
+    fprintf(out, "// Index of the default keyword spelled word[0, len), or -1\n");
+    fprintf(out, "static int generated_keyword_index(const char* word, size_t len, bool fold_case) {\n");
+    fprintf(out, "    unsigned char fold = fold_case ? 0x20 : 0;\n");
+    fprintf(out, "    switch (len) {\n");
+    for (size_t length = 1; length <= max_length; length++) {
+        bool any = false;
+        for (int i = 0; i < tokenizer->keywords_count; i++) {
+            any |= strlen(tokenizer->keywords[i]) == length;
+        }
+        if (!any) continue;
+        
+        fprintf(out, "    case %zu:\n", length);
+        fprintf(out, "        switch ((unsigned char)word[0]) {\n");
+        bool seen[256] = { false };
+        for (int i = 0; i < tokenizer->keywords_count; i++) {
+            const char* keyword = tokenizer->keywords[i];
+            unsigned char first = (unsigned char)keyword[0];
+            if (gen_is_letter(first)) first |= 0x20;
+            if (strlen(keyword) != length || seen[first]) continue;
+            seen[first] = true;
+            
+            // Both cases of a letter lead here; the test below sorts out
+            // whether the case has to match
+            fprintf(out, "        case ");
+            gen_char_literal(out, first);
+            if (gen_is_letter(first)) {
+                fprintf(out, ": case ");
+                gen_char_literal(out, (unsigned char)(first & ~0x20));
+            }
+            fprintf(out, ":\n");
+            for (int j = i; j < tokenizer->keywords_count; j++) {
+                const char* other = tokenizer->keywords[j];
+                unsigned char other_first = (unsigned char)other[0];
+                if (gen_is_letter(other_first)) other_first |= 0x20;
+                if (strlen(other) != length || other_first != first) continue;
+                fprintf(out, "            if (");
+                gen_keyword_byte(out, 0, (unsigned char)other[0]);
+                for (size_t k = 1; k < length; k++) {
+                    fprintf(out, " &&\n                ");
+                    gen_keyword_byte(out, (int)k, (unsigned char)other[k]);
+                }
+                fprintf(out, ") return %d;\n", j);
+            }
+            fprintf(out, "            break;\n");
+        }
+        fprintf(out, "        }\n");
+        fprintf(out, "        break;\n");
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return -1;\n");
+    fprintf(out, "}\n");
+}
+
+static void gen_punct_accept(FILE* out, int depth, const PunctState* state, size_t length) {
+    gen_indent(out, depth);
+    if (!state) {
+        fprintf(out, "return 0;\n");
+        return;
+    }
+    fprintf(out, "*type = %s; *index = %d; return %zu;\n",
+            state->accept == TOKEN_OPERATOR ? "TOKEN_OPERATOR" : "TOKEN_DELIMITER",
+            state->accept_index, length);
+}
+
+// One DFA state `length` bytes into the match. fallback is the longest
+// accepting state on the way here, taken when no longer match exists.
+static void gen_punct_state(FILE* out, const PunctDfa* dfa, int state_index, size_t length,
+                            const PunctState* fallback, size_t fallback_length, int depth) {
+    const PunctState* state = &dfa->states[state_index];
+    if (state->accept != TOKEN_EOF) {
+        fallback = state;
+        fallback_length = length;
+    }
+    if (state->first_child >= 0) {
+        gen_indent(out, depth);
+        fprintf(out, "if (pos + %zu < len) {\n", length);
+        gen_indent(out, depth + 1);
+        fprintf(out, "switch ((unsigned char)input[pos + %zu]) {\n", length);
+        for (int child = state->first_child; child >= 0; child = dfa->states[child].next_sibling) {
+            gen_indent(out, depth + 1);
+            fprintf(out, "case ");
+            gen_char_literal(out, dfa->states[child].byte);
+            fprintf(out, ":\n");
+            gen_punct_state(out, dfa, child, length + 1, fallback, fallback_length, depth + 2);
+        }
+        gen_indent(out, depth + 1);
+        fprintf(out, "}\n");
+        gen_indent(out, depth);
+        fprintf(out, "}\n");
+    }
+    gen_punct_accept(out, depth, fallback, fallback_length);
+}
+
+static void gen_punct_matcher(FILE* out, const Tokenizer* tokenizer) {
+    const PunctDfa* dfa = &tokenizer->punct;
+    fprintf(out, "// Longest default operator or delimiter at input[pos]; 0 when none\n");
+    fprintf(out, "static size_t generated_punct_match(const char* input, size_t pos, size_t len,\n");
+    fprintf(out, "                                    TokenType* type, int* index) {\n");
+    fprintf(out, "    switch ((unsigned char)input[pos]) {\n");
+    for (int byte = 0; byte < 256; byte++) {
+        if (dfa->dispatch[byte] < 0) continue;
+        fprintf(out, "    case ");
+        gen_char_literal(out, (unsigned char)byte);
+        fprintf(out, ":\n");
+        gen_punct_state(out, dfa, dfa->dispatch[byte], 1, NULL, 0, 2);
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+}
+
+int generate_default_lexer(FILE* out) {
+    TokenizerOptions options = {0};
+    Tokenizer* tokenizer = create_tokenizer(&options);
+    if (!tokenizer) return 1;
+    
+    fprintf(out, "// Generated by `lexer --gen-lexer` from default_keywords, default_operators\n");
+    fprintf(out, "// and default_delimiters in lexer.c. Do not edit.\n\n");
+    fprintf(out, "#define GENERATED_LEXER_FINGERPRINT UINT64_C(0x%016llx)\n\n",
+            (unsigned long long)default_tables_fingerprint());
+    gen_keyword_matcher(out, tokenizer);
+    fprintf(out, "\n");
+    gen_punct_matcher(out, tokenizer);
+    
+    free_tokenizer(tokenizer);
+    return ferror(out) ? 1 : 0;
+}
+
 // Demonstration function
 void demonstrate_tokenizer() {
     printf("=== Tokenizer Demo ===\n\n");
@@ -639,6 +3057,125 @@ void demonstrate_tokenizer() {
     for (int i = 0; i < comments->count; i++) {
         printf("  \"%s\"\n", comments->tokens[i].value);
     }
+    printf("\n");
+    
+    // Zero-copy tokens reference the input instead of owning their text
+    printf("5. Zero-copy tokens:\n");
+    TokenizerOptions slice_options = {0};
+    slice_options.case_sensitive = true;
+    slice_options.skip_unknown = true;
+    slice_options.zero_copy = true;
+    
+    Tokenizer* slice_tokenizer = create_tokenizer(&slice_options);
+    TokenArray* slice_tokens = tokenize(slice_tokenizer, code);
+    TokenArray* strings = find_tokens_by_type(slice_tokens, TOKEN_STRING);
+    for (int i = 0; i < strings->count; i++) {
+        size_t length = 0;
+        const char* text = token_text(&strings->tokens[i], strings->source, &length);
+        printf("  offset %zu: \"%.*s\"\n", strings->tokens[i].offset, (int)length, text);
+    }
+    printf("\n");
+    
+    // Pull tokens one at a time instead of materializing the whole array
+    printf("6. Streaming lexer:\n");
+    Lexer* lexer = create_lexer(tokenizer, code, strlen(code));
+    int statements = 0;
+    for (;;) {
+        Token token = lexer_next(lexer);
+        TokenType type = token.type;
+        if (type == TOKEN_KEYWORD && strcmp(token.value, "let") == 0) {
+            const Token* name = lexer_peek(lexer, 0);
+            printf("  let binding: %s\n", name->value);
+        }
+        if (type == TOKEN_DELIMITER && strcmp(token.value, ";") == 0) {
+            statements++;
+        }
+        free_token(&token);
+        if (type == TOKEN_EOF) break;
+    }
+    printf("  %d statements\n", statements);
+    free_lexer(lexer);
+    printf("\n");
+    
+    // Positions resolved on demand through the line index
+    printf("7. Token at position 4:9:\n");
+    Token* at = get_token_at_position(tokens, 4, 9);
+    if (at) {
+        printf("  %s \"%s\"\n", token_type_to_string(at->type), at->value);
+    }
+    printf("\n");
+    
+    // Compact storage with an index view instead of copied tokens
+    printf("8. Keywords from a token buffer:\n");
+    TokenBuffer* buffer = tokenize_to_buffer(tokenizer, code, strlen(code));
+    TokenView* keywords = find_tokens_by_type_view(buffer, TOKEN_KEYWORD);
+    for (size_t i = 0; i < keywords->count; i++) {
+        size_t length = 0;
+        const char* text = token_buffer_text(buffer, keywords->indices[i], &length);
+        printf("%.*s ", (int)length, text);
+    }
+    printf("\n");
+    free_token_view(keywords);
+    free_token_buffer(buffer);
+    printf("\n");
+    
+    // Interned names compare by atom
+    printf("9. Interned identifiers:\n");
+    TokenizerOptions intern_options = {0};
+    intern_options.case_sensitive = true;
+    intern_options.skip_unknown = true;
+    intern_options.intern_atoms = true;
+    
+    Tokenizer* intern_tokenizer = create_tokenizer(&intern_options);
+    TokenArray* interned = tokenize(intern_tokenizer, code);
+    Atom x_atom = intern_string("x");
+    int x_uses = 0;
+    for (int i = 0; i < interned->count; i++) {
+        if (interned->tokens[i].type == TOKEN_IDENTIFIER && interned->tokens[i].atom == x_atom) x_uses++;
+    }
+    printf("  \"x\" appears %d times, %zu distinct names interned\n", x_uses, intern_count());
+    free_token_array(interned);
+    free_tokenizer(intern_tokenizer);
+    printf("\n");
+    
+    // Number tokens carry their decoded value
+    printf("10. Numeric literals:\n");
+    const char* numbers_code = "42 1_000_000 0xFF 0b1010 3.25 6.02e23 1.2.3 9223372036854775808";
+    Tokenizer* number_tokenizer = create_tokenizer(NULL);
+    TokenArray* numbers = tokenize(number_tokenizer, numbers_code);
+    for (int i = 0; i < numbers->count; i++) {
+        Token* token = &numbers->tokens[i];
+        if (token->number.kind == NUMBER_INT) {
+            printf("  %-22s int   %lld\n", token->value, (long long)token->number.int_value);
+        } else if (token->number.kind == NUMBER_FLOAT) {
+            printf("  %-22s float %.17g\n", token->value, token->number.float_value);
+        } else if (token->type != TOKEN_EOF) {
+            printf("  %-22s %s\n", token->value, token_type_to_string(token->type));
+        }
+    }
+    free_token_array(numbers);
+    free_tokenizer(number_tokenizer);
+    printf("\n");
+    
+    // Re-lex only around an edit
+    printf("11. Incremental re-lexing:\n");
+    const char* before = "let total = count + 1;\nprint(total);\n";
+    const char* after = "let total = count * scale + 1;\nprint(total);\n";
+    Tokenizer* edit_tokenizer = create_tokenizer(NULL);
+    TokenArray* edited = tokenize(edit_tokenizer, before);
+    TokenChange change;
+    // "+" at offset 18 became "* scale +"
+    if (relex_tokens(edit_tokenizer, edited, after, strlen(after), 18, 1, 9, &change)) {
+        printf("  replaced %d token(s) at index %d with %d:", change.removed, change.first, change.inserted);
+        for (int i = change.first; i < change.first + change.inserted; i++) {
+            printf(" %s", edited->tokens[i].value);
+        }
+        printf("\n  now %d tokens, last \"%s\" at %d:%d\n", edited->count,
+               edited->tokens[edited->count - 2].value,
+               edited->tokens[edited->count - 2].line, edited->tokens[edited->count - 2].column);
+    }
+    free_token_array(edited);
+    free_tokenizer(edit_tokenizer);
     
     // Cleanup
     free_string_array(token_strings, string_count);
@@ -646,12 +3183,228 @@ void demonstrate_tokenizer() {
     free_token_array(identifiers);
     free_token_array(custom_tokens);
     free_token_array(comments);
+    free_token_array(slice_tokens);
+    free_token_array(strings);
     free_tokenizer(tokenizer);
     free_tokenizer(custom_tokenizer);
+    free_tokenizer(slice_tokenizer);
+}
+
+// Benchmark: keyword table vs. the linear strcmp scan it replaced
+static double elapsed_seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void benchmark_keyword_lookup() {
+    printf("=== Keyword Lookup Benchmark ===\n\n");
+    
+    static const char* words[] = {
+        "fn", "main", "let", "x", "counter", "if", "else", "value", "return",
+        "print", "result", "while", "index", "const", "buffer", "true", "length",
+        "for", "item", "null", "undefined_value", "string", "name", "var", "total"
+    };
+    const int word_count = sizeof(words) / sizeof(words[0]);
+    const int iterations = 200000;
+    
+    for (int pass = 0; pass < 2; pass++) {
+        TokenizerOptions options = {0};
+        options.case_sensitive = (pass == 0);
+        options.skip_unknown = true;
+        Tokenizer* tokenizer = create_tokenizer(&options);
+        
+        long hits = 0;
+        long linear_hits = 0;
+        clock_t start = clock();
+        for (int it = 0; it < iterations; it++) {
+            for (int w = 0; w < word_count; w++) {
+                hits += is_keyword_linear(tokenizer, words[w]);
+            }
+        }
+        double linear_time = elapsed_seconds(start);
+        linear_hits = hits;
+        
+        bool generated = tokenizer->generated;
+        tokenizer->generated = false;
+        start = clock();
+        for (int it = 0; it < iterations; it++) {
+            for (int w = 0; w < word_count; w++) {
+                hits -= is_keyword(tokenizer, words[w]);
+            }
+        }
+        double table_time = elapsed_seconds(start);
+        
+        double generated_time = 0;
+        if (generated) {
+            tokenizer->generated = true;
+            long generated_hits = 0;
+            start = clock();
+            for (int it = 0; it < iterations; it++) {
+                for (int w = 0; w < word_count; w++) {
+                    generated_hits += is_keyword(tokenizer, words[w]);
+                }
+            }
+            generated_time = elapsed_seconds(start);
+            hits += generated_hits - linear_hits;
+        }
+        
+        double lookups = (double)iterations * word_count;
+        printf("%s:\n", pass == 0 ? "Case sensitive" : "Case insensitive");
+        printf("  linear scan:   %8.2f ns/lookup\n", linear_time * 1e9 / lookups);
+        printf("  keyword table: %8.2f ns/lookup\n", table_time * 1e9 / lookups);
+        if (generated) {
+            printf("  generated:     %8.2f ns/lookup\n", generated_time * 1e9 / lookups);
+        }
+        if (hits != 0) {
+            printf("  MISMATCH between lookup paths\n");
+        }
+        
+        free_tokenizer(tokenizer);
+    }
+}
+
+// Benchmark: tokenize() throughput for each available set of scanning kernels
+void benchmark_tokenize_throughput() {
+    printf("=== Tokenize Throughput Benchmark ===\n\n");
+    
+    static const char* block =
+        "/* Generated helper: accumulates a running total over the input table.\n"
+        " * The body is intentionally repetitive, like our generated scripts.\n"
+        " */\n"
+        "fn accumulate_values(int count, float scale) {\n"
+        "    let running_total_value = 0;\n"
+        "    let message = \"accumulating values for the generated lookup table\";\n"
+        "    for (let index = 0; index < count; index += 1) {\n"
+        "        running_total_value = running_total_value + index * 1234567.875;\n"
+        "        // keep the intermediate value around for debugging purposes\n"
+        "        if (running_total_value >= 1000000000) { return running_total_value; }\n"
+        "    }\n"
+        "                                                                \n"
+        "    return running_total_value * scale;\n"
+        "}\n\n";
+    size_t block_len = strlen(block);
+    size_t target = 16 * 1024 * 1024;
+    size_t repeat = target / block_len + 1;
+    size_t len = block_len * repeat;
+    char* input = malloc(len);
+    if (!input) return;
+    for (size_t r = 0; r < repeat; r++) {
+        memcpy(input + r * block_len, block, block_len);
+    }
+    
+    const ScanKernels* candidates[3];
+    int candidate_count = 0;
+    candidates[candidate_count++] = &scalar_kernels;
+#ifdef LEXER_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) candidates[candidate_count++] = &sse2_kernels;
+    if (__builtin_cpu_supports("avx2")) candidates[candidate_count++] = &avx2_kernels;
+#endif
+    
+    TokenizerOptions options = {0};
+    options.case_sensitive = true;
+    options.skip_unknown = true;
+    options.zero_copy = true;
+    Tokenizer* tokenizer = create_tokenizer(&options);
+    
+    printf("Input: %.1f MB (selected kernels: %s)\n", len / (1024.0 * 1024.0),
+           select_scan_kernels()->name);
+    for (int c = 0; c < candidate_count; c++) {
+        tokenizer->kernels = candidates[c];
+        double best = 0;
+        int token_count = 0;
+        for (int run = 0; run < 3; run++) {
+            clock_t start = clock();
+            TokenArray* tokens = tokenize_n(tokenizer, input, len);
+            double seconds = elapsed_seconds(start);
+            token_count = tokens ? tokens->count : 0;
+            free_token_array(tokens);
+            if (run == 0 || seconds < best) best = seconds;
+        }
+        printf("  %-8s %8.1f MB/s  (%d tokens)\n", candidates[c]->name,
+               best > 0 ? len / best / (1024.0 * 1024.0) : 0.0, token_count);
+    }
+    
+    // clock() adds up CPU time over all threads, so time this one by the
+    // wall clock
+    tokenizer->kernels = select_scan_kernels();
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double best = 0;
+    int token_count = 0;
+    for (int run = 0; run < 3; run++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        TokenArray* tokens = tokenize_parallel(tokenizer, input, len, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        token_count = tokens ? tokens->count : 0;
+        free_token_array(tokens);
+        if (run == 0 || seconds < best) best = seconds;
+    }
+    printf("  parallel %8.1f MB/s  (%d tokens, %ld threads)\n",
+           best > 0 ? len / best / (1024.0 * 1024.0) : 0.0, token_count, cpus > 0 ? cpus : 1);
+    
+    free_tokenizer(tokenizer);
+    free(input);
 }
 
 // Example main function
-int main() {
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--gen-lexer") == 0) {
+        return generate_default_lexer(stdout);
+    }
+    
+    // Tokenize files through a token cache and report hits and misses
+    if (argc > 3 && strcmp(argv[1], "--cache") == 0) {
+        TokenCache* cache = token_cache_open(argv[2]);
+        if (!cache) {
+            fprintf(stderr, "Cannot open cache directory %s\n", argv[2]);
+            return 1;
+        }
+        Tokenizer* tokenizer = create_tokenizer(NULL);
+        int status = 0;
+        for (int i = 3; i < argc; i++) {
+            TokenBuffer* buffer = tokenize_file_cached(cache, tokenizer, argv[i]);
+            if (!buffer) {
+                fprintf(stderr, "Cannot read %s\n", argv[i]);
+                status = 1;
+                continue;
+            }
+            printf("%s: %zu tokens\n", argv[i], buffer->count);
+            free_token_buffer(buffer);
+        }
+        printf("cache: %zu hits, %zu misses, %zu stored\n", cache->hits, cache->misses, cache->stores);
+        free_tokenizer(tokenizer);
+        token_cache_close(cache);
+        return status;
+    }
+    
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        benchmark_keyword_lookup();
+        printf("\n");
+        benchmark_tokenize_throughput();
+        return 0;
+    }
+    
+    // Tokenize a file given on the command line ("-" for stdin)
+    if (argc > 1) {
+        TokenizerOptions options = {0};
+        options.case_sensitive = true;
+        options.skip_unknown = true;
+        options.zero_copy = true;
+        
+        Tokenizer* tokenizer = create_tokenizer(&options);
+        TokenArray* tokens = tokenize_file(tokenizer, argv[1]);
+        if (!tokens) {
+            fprintf(stderr, "Cannot read %s\n", argv[1]);
+            free_tokenizer(tokenizer);
+            return 1;
+        }
+        pretty_print_tokens(tokens);
+        free_token_array(tokens);
+        free_tokenizer(tokenizer);
+        return 0;
+    }
+    
     demonstrate_tokenizer();
     
     // Simple example
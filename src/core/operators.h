@@ -0,0 +1,66 @@
+#ifndef OPERATORS_H
+#define OPERATORS_H
+
+#include <stddef.h>
+#include <string.h>
+
+// Operator codes shared by the lexer and the AST. The lexer tags each
+// operator token with its code, and expression nodes store the code rather
+// than the operator text, so evaluators can switch on it.
+typedef enum {
+    OP_NONE,                // not an operator, or one outside this table
+    OP_EQ,                  // ==
+    OP_NE,                  // !=
+    OP_LE,                  // <=
+    OP_GE,                  // >=
+    OP_LOGICAL_AND,         // &&
+    OP_LOGICAL_OR,          // ||
+    OP_INCREMENT,           // ++
+    OP_DECREMENT,           // --
+    OP_ADD_ASSIGN,          // +=
+    OP_SUB_ASSIGN,          // -=
+    OP_MUL_ASSIGN,          // *=
+    OP_DIV_ASSIGN,          // /=
+    OP_ADD,                 // +
+    OP_SUB,                 // -
+    OP_MUL,                 // *
+    OP_DIV,                 // /
+    OP_MOD,                 // %
+    OP_ASSIGN,              // =
+    OP_LT,                  // <
+    OP_GT,                  // >
+    OP_NOT,                 // !
+    OP_BIT_AND,             // &
+    OP_BIT_OR,              // |
+    OP_BIT_XOR,             // ^
+    OP_BIT_NOT,             // ~
+    OP_QUESTION,            // ?
+    OP_COLON,               // :
+    OP_COUNT
+} OperatorKind;
+
+static const char* const operator_strings[OP_COUNT] = {
+    "", "==", "!=", "<=", ">=", "&&", "||", "++", "--", "+=", "-=", "*=", "/=",
+    "+", "-", "*", "/", "%", "=", "<", ">", "!", "&", "|", "^", "~", "?", ":"
+};
+
+// Source text of an operator; empty for OP_NONE
+static inline const char* operator_to_string(OperatorKind op) {
+    return (unsigned)op < OP_COUNT ? operator_strings[op] : "";
+}
+
+// Operator spelled by str[0, length), OP_NONE if there is none
+static inline OperatorKind operator_from_string_n(const char* str, size_t length) {
+    for (int op = OP_NONE + 1; op < OP_COUNT; op++) {
+        if (strlen(operator_strings[op]) == length && memcmp(operator_strings[op], str, length) == 0) {
+            return (OperatorKind)op;
+        }
+    }
+    return OP_NONE;
+}
+
+static inline OperatorKind operator_from_string(const char* str) {
+    return str ? operator_from_string_n(str, strlen(str)) : OP_NONE;
+}
+
+#endif